@@ -0,0 +1,74 @@
+#include "async_renderer.hpp"
+#include <random>
+
+// Renders frames from a few coroutines at once, each awaiting its frames one
+// after the other, and writes them to async_image.bin in the order they
+// arrive.
+
+namespace
+{
+vkx::task draw(vkx::async_renderer &async, vkx::render_job job, size_t frames,
+               std::mutex &write_mutex, std::ofstream &write_image)
+{
+    for (size_t frame = 0; frame < frames; ++frame)
+    {
+        vkx::render_result result = co_await async.render(job);
+
+        std::lock_guard<std::mutex> lock(write_mutex);
+        write_image.write(result.pixels.data(),
+                          std::streamsize(result.pixels.size()));
+    }
+}
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        size_t frame_count = argc > 1 ? std::stoul(argv[1]) : 16;
+        size_t coroutines  = argc > 2 ? std::stoul(argv[2]) : 4;
+        if (coroutines == 0)
+            throw std::runtime_error("at least one coroutine is required");
+
+        std::random_device                    r;
+        std::default_random_engine            e1(r());
+        std::uniform_real_distribution<float> uniform_dist(0.5f, 1.0f);
+
+        std::ofstream write_image("async_image.bin", std::ios::binary);
+        std::mutex    write_mutex;
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            vkx::renderer       renderer;
+            vkx::async_renderer async(renderer);
+
+            std::vector<vkx::task> tasks;
+            for (size_t i = 0; i < coroutines; ++i)
+            {
+                vkx::render_job job;
+                job.constants.fill(glm::vec3(
+                    uniform_dist(e1), uniform_dist(e1), uniform_dist(e1)));
+                auto frames = frame_count / coroutines +
+                              (i < frame_count % coroutines ? 1 : 0);
+                tasks.push_back(
+                    draw(async, job, frames, write_mutex, write_image));
+            }
+            for (auto &task : tasks)
+                task.wait();
+        }
+
+        std::cout << "rendered " << frame_count << " frames from "
+                  << coroutines << " coroutines in "
+                  << std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count()
+                  << " ms" << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
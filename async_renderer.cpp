@@ -0,0 +1,166 @@
+#include "async_renderer.hpp"
+
+namespace vkx
+{
+// the frame is destroyed right after this returns, the state outlives it
+std::suspend_never task::promise_type::final_suspend() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->done = true;
+    }
+    shared->finished.notify_all();
+    return {};
+}
+
+void task::promise_type::unhandled_exception()
+{
+    shared->exception = std::current_exception();
+}
+
+task::~task()
+{
+    if (!shared)
+        return;
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->finished.wait(lock, [this]() { return shared->done; });
+}
+
+void task::wait()
+{
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->finished.wait(lock, [this]() { return shared->done; });
+    if (shared->exception)
+        std::rethrow_exception(shared->exception);
+}
+
+render_operation::render_operation(async_renderer &owner, const render_job &job)
+    : owner(owner), job(job)
+{
+    result.width  = job.width;
+    result.height = job.height;
+    result.format = job.format;
+}
+
+bool render_operation::await_suspend(std::coroutine_handle<> awaiting)
+{
+    if (!owner.begin_render())
+    {
+        failure = "the async renderer is shutting down";
+        return false;
+    }
+
+    // runs on the render worker, which must not run the coroutine itself
+    try
+    {
+        owner.worker.enqueue(job, [this, awaiting](const void *pixels,
+                                                   size_t      size) {
+            if (pixels)
+            {
+                auto begin = static_cast<const char *>(pixels);
+                result.pixels.assign(begin, begin + size);
+            }
+            else
+                failure = "rendering failed";
+            owner.resume_later(awaiting);
+        });
+    }
+    catch (...)
+    {
+        // the job never made it to the worker, co_await throws right away
+        owner.end_render();
+        throw;
+    }
+    return true;
+}
+
+render_result render_operation::await_resume()
+{
+    if (failure)
+        throw std::runtime_error(failure);
+    return std::move(result);
+}
+
+async_renderer::async_renderer(vkx::renderer &renderer, size_t resume_threads,
+                               size_t capacity)
+    : worker(renderer, capacity)
+{
+    if (resume_threads == 0)
+        throw std::runtime_error("at least one resume thread is required");
+    for (size_t i = 0; i < resume_threads; ++i)
+        threads.emplace_back([this]() { resume(); });
+}
+
+async_renderer::~async_renderer()
+{
+    // Coroutines resumed from here on fail to render again instead of
+    // enqueueing jobs nobody would wait for. A render that was accepted just
+    // before may reach the worker after a flush, hence the loop.
+    std::unique_lock<std::mutex> lock(mutex);
+    accepting = false;
+    while (outstanding > 0)
+    {
+        lock.unlock();
+        worker.flush();
+        lock.lock();
+        drained.wait_for(lock, std::chrono::milliseconds(1),
+                         [this]() { return outstanding == 0; });
+    }
+    stopping = true;
+    lock.unlock();
+    resumable.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+render_operation async_renderer::render(const render_job &job)
+{
+    return render_operation(*this, job);
+}
+
+bool async_renderer::begin_render()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!accepting)
+        return false;
+    ++outstanding;
+    return true;
+}
+
+void async_renderer::end_render()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--outstanding == 0)
+        drained.notify_all();
+}
+
+void async_renderer::resume_later(std::coroutine_handle<> coroutine)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        coroutines.push_back(coroutine);
+    }
+    resumable.notify_one();
+}
+
+void async_renderer::resume()
+{
+    for (;;)
+    {
+        std::coroutine_handle<> coroutine;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            resumable.wait(lock, [this]() {
+                return stopping || !coroutines.empty();
+            });
+            if (coroutines.empty())
+                return;
+            coroutine = coroutines.front();
+            coroutines.pop_front();
+            if (--outstanding == 0)
+                drained.notify_all();
+        }
+        coroutine.resume();
+    }
+}
+}
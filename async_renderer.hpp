@@ -0,0 +1,130 @@
+#pragma once
+
+#include "render_worker.hpp"
+#include <coroutine>
+
+namespace vkx
+{
+class async_renderer;
+
+// A coroutine that starts running right away and that code which is not a
+// coroutine itself can wait for, which is how work on an async_renderer
+// gets started:
+//
+//     vkx::task draw(vkx::async_renderer &async, vkx::render_job job)
+//     {
+//         vkx::render_result result = co_await async.render(job);
+//         ...
+//     }
+//
+//     draw(async, job).wait();
+//
+// The coroutine frame frees itself when the coroutine finishes, the task
+// only keeps track of whether it has. Destroying a task waits for it.
+class task
+{
+  public:
+    struct state
+    {
+        std::mutex              mutex;
+        std::condition_variable finished;
+        bool                    done = false;
+        std::exception_ptr      exception;
+    };
+
+    struct promise_type
+    {
+        std::shared_ptr<state> shared = std::make_shared<state>();
+
+        task                get_return_object() { return task(shared); }
+        std::suspend_never  initial_suspend() noexcept { return {}; }
+        std::suspend_never  final_suspend() noexcept;
+        void                return_void() {}
+        void                unhandled_exception();
+    };
+
+    task(task &&) = default;
+    task &operator=(task &&) = default;
+
+    ~task();
+
+    // Waits for the coroutine to finish and rethrows what escaped it.
+    void wait();
+
+  private:
+    explicit task(std::shared_ptr<state> shared) : shared(std::move(shared))
+    {
+    }
+
+    std::shared_ptr<state> shared;
+};
+
+// Awaiting it renders the job and resumes the awaiting coroutine on one of
+// the resume threads of the async_renderer once the pixels are back. Throws
+// from co_await when the job fails or the async_renderer is being
+// destroyed.
+class render_operation
+{
+  public:
+    bool          await_ready() const noexcept { return false; }
+    bool          await_suspend(std::coroutine_handle<> awaiting);
+    render_result await_resume();
+
+  private:
+    friend class async_renderer;
+
+    render_operation(async_renderer &owner, const render_job &job);
+
+    async_renderer &owner;
+    render_job      job;
+    render_result   result;
+    const char *    failure = nullptr;
+};
+
+// Lets coroutines render without a thread per frame in flight:
+//
+//     vkx::render_result result = co_await async.render(job);
+//
+// Jobs go through a render_worker, so nothing blocks while the GPU works.
+// Coroutines are resumed on a small pool of threads rather than the render
+// worker, which would stall every other job while they run. Like the
+// render_worker, it needs exclusive use of the renderer.
+class async_renderer
+{
+  public:
+    explicit async_renderer(vkx::renderer &renderer, size_t resume_threads = 2,
+                            size_t capacity = 256);
+
+    async_renderer(const async_renderer &) = delete;
+    async_renderer &operator=(const async_renderer &) = delete;
+
+    // Stops accepting renders, then finishes every pending one and resumes
+    // its coroutine. Renders awaited from then on fail right away, so
+    // coroutines that keep rendering come to an end.
+    ~async_renderer();
+
+    // Enqueueing happens when the operation is awaited and waits for room
+    // in the render worker's queue.
+    render_operation render(const render_job &job);
+
+  private:
+    friend class render_operation;
+
+    bool begin_render();
+    void end_render();
+    void resume_later(std::coroutine_handle<> coroutine);
+    void resume();
+
+    std::mutex                          mutex;
+    std::condition_variable             resumable;
+    std::condition_variable             drained;
+    std::deque<std::coroutine_handle<>> coroutines;
+    // renders awaited and not yet handed to a resume thread
+    size_t                              outstanding = 0;
+    bool                                accepting   = true;
+    bool                                stopping    = false;
+    std::vector<std::thread>            threads;
+    // its thread calls resume_later, so it is constructed after the above
+    render_worker worker;
+};
+}
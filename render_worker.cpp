@@ -0,0 +1,129 @@
+#include "render_worker.hpp"
+
+namespace vkx
+{
+render_worker::render_worker(vkx::renderer &renderer, size_t capacity)
+    : renderer(renderer), jobs(capacity), thread([this]() { run(); })
+{
+}
+
+render_worker::~render_worker()
+{
+    stopping.store(true);
+    wake.notify_one();
+    thread.join();
+}
+
+bool render_worker::try_enqueue(const render_job &job, frame_callback on_frame)
+{
+    queued_job queued{job, std::move(on_frame)};
+    return try_push(queued);
+}
+
+void render_worker::enqueue(const render_job &job, frame_callback on_frame)
+{
+    queued_job queued{job, std::move(on_frame)};
+    while (!try_push(queued))
+        std::this_thread::yield();
+}
+
+void render_worker::flush()
+{
+    auto enqueued = jobs.push_count();
+    auto target   = flush_target.load();
+    while (target < enqueued &&
+           !flush_target.compare_exchange_weak(target, enqueued))
+    {
+    }
+    wake.notify_one();
+
+    while (flushed.load(std::memory_order_acquire) < enqueued)
+        std::this_thread::yield();
+}
+
+bool render_worker::try_push(queued_job &queued)
+{
+    if (!jobs.try_push(std::move(queued)))
+        return false;
+
+    // pairs with the fence in run(), so that either the worker sees the job
+    // before it sleeps or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed))
+        wake.notify_one();
+    return true;
+}
+
+// Progress is published even if the renderer failed, it has handed the
+// frames it lost to their callbacks as failures.
+void render_worker::flush_renderer()
+{
+    try
+    {
+        renderer.flush();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "flushing the renderer failed: " << e.what()
+                  << std::endl;
+    }
+    flushed.store(jobs.pop_count(), std::memory_order_release);
+}
+
+void render_worker::run()
+{
+    queued_job queued;
+    for (;;)
+    {
+        auto target = flush_target.load(std::memory_order_acquire);
+        if (flushed.load(std::memory_order_relaxed) < target &&
+            jobs.pop_count() >= target)
+            flush_renderer();
+
+        if (jobs.try_pop(queued))
+        {
+            // the renderer gets a copy so that the callback is still around
+            // to report a failure
+            try
+            {
+                renderer.render(queued.job, queued.on_frame);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "render job failed: " << e.what() << std::endl;
+                if (queued.on_frame)
+                    queued.on_frame(nullptr, 0);
+            }
+            continue;
+        }
+
+        if (stopping.load())
+        {
+            flush_renderer();
+            return;
+        }
+
+        // out of work for now, submit what is due and hand out what has
+        // finished without draining the device
+        try
+        {
+            renderer.poll();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "polling the renderer failed: " << e.what()
+                      << std::endl;
+        }
+
+        // producers never take the mutex, so a wakeup can still slip through
+        // between the check and the wait. The timeout bounds what that costs.
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (jobs.empty() && !stopping.load() &&
+            flush_target.load() <= flushed.load())
+            wake.wait_for(lock, std::chrono::milliseconds(1));
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "renderer.hpp"
+
+namespace vkx
+{
+// Lets any number of threads hand jobs to a renderer. A single worker thread
+// drains a bounded lock-free queue into the renderer, which nobody else may
+// use while the worker exists. Callbacks run on the worker thread, in the
+// order the jobs were dequeued. A job the renderer rejects is reported with
+// null pixels. While the queue is empty the worker submits what is due and
+// hands out finished frames, it only waits for the device when flushing.
+class render_worker
+{
+  public:
+    render_worker(vkx::renderer &renderer, size_t capacity = 256);
+
+    render_worker(const render_worker &) = delete;
+    render_worker &operator=(const render_worker &) = delete;
+
+    // Renders everything enqueued so far and stops the worker.
+    ~render_worker();
+
+    // Fails when the queue is full.
+    bool try_enqueue(const render_job &job, frame_callback on_frame);
+
+    // Waits for room in the queue, which is how a worker that falls behind
+    // slows its producers down.
+    void enqueue(const render_job &job, frame_callback on_frame);
+
+    // Waits until every job enqueued before the call has been rendered and
+    // handed out. The worker flushes the renderer as soon as it dequeued
+    // those jobs, so this returns while other producers keep enqueueing.
+    void flush();
+
+  private:
+    struct queued_job
+    {
+        render_job     job;
+        frame_callback on_frame;
+    };
+
+    bool try_push(queued_job &queued);
+    void flush_renderer();
+    void run();
+
+    vkx::renderer &             renderer;
+    vkx::mpsc_queue<queued_job> jobs;
+    std::atomic<size_t>         flush_target{0};
+    std::atomic<size_t>         flushed{0};
+    std::atomic<bool>           sleeping{false};
+    std::atomic<bool>           stopping{false};
+    std::mutex                  mutex;
+    std::condition_variable     wake;
+    std::thread                 thread;
+};
+}
@@ -0,0 +1,1343 @@
+#include "renderer.hpp"
+
+#ifdef VKX_EMBEDDED_SHADERS
+namespace shaders
+{
+// generated by the build_shaders target
+constexpr uint32_t offscreen_vert[] = {
+#include "offscreen.vert.inc"
+};
+
+constexpr uint32_t offscreen_bindless_vert[] = {
+#include "offscreen_bindless.vert.inc"
+};
+
+constexpr uint32_t offscreen_frag[] = {
+#include "offscreen.frag.inc"
+};
+}
+#endif
+
+namespace vkx
+{
+namespace
+{
+// The constants of a job as the vertex shader reads them from its uniform
+// buffer, with vec3 array elements padded to 16 bytes.
+struct job_parameters
+{
+    std::array<glm::vec4, 16> colors;
+};
+
+// How draws get their buffers: pushed through the template when there is
+// one, from the set with dynamic offsets otherwise. Bindless draws also bind
+// the set of meshes and only pick their element per draw.
+struct draw_descriptors
+{
+    const vkx::descriptor_push_template *push = nullptr;
+    vk::DescriptorSet                    set;
+    vk::DescriptorSet                    meshes;
+    vk::Buffer                           geometry;
+    vk::Buffer                           parameters;
+};
+
+// The most meshes a bindless renderer holds at once, fewer if the device
+// limits the descriptor array, down to the fewest it falls back below.
+constexpr uint32_t max_bindless_meshes = 4096;
+constexpr uint32_t min_bindless_meshes = 256;
+
+// Bytes of vertex positions all meshes share. Bound descriptors give every
+// mesh the same range at its dynamic offset, which caps the size of one
+// mesh, pushed and bindless descriptors bind each mesh with its own size.
+constexpr vk::DeviceSize geometry_capacity    = 16 << 20;
+constexpr vk::DeviceSize bound_geometry_range = 64 << 10;
+
+// What the push template reads, one entry per binding.
+struct pushed_descriptors
+{
+    vk::DescriptorBufferInfo geometry;
+    vk::DescriptorBufferInfo parameters;
+};
+
+vkx::command_buffer allocate_command_buffer(
+    vk::Device device, vk::CommandPool command_pool,
+    vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary)
+{
+    vk::CommandBufferAllocateInfo commandBufferAllocateInfo;
+    commandBufferAllocateInfo.setCommandPool(command_pool)
+        .setLevel(level)
+        .setCommandBufferCount(1);
+    return vkx::command_buffer(
+        device.allocateCommandBuffers(commandBufferAllocateInfo)[0],
+        vkx::command_buffer_deleter{device, command_pool});
+}
+
+// A slot reads back on the transfer queue when it has a family of its own,
+// which takes a second command buffer and a semaphore to hand the color
+// attachment over. With more than one recording thread, each of them draws
+// into a secondary command buffer from its own pool.
+frame_slot
+create_frame_slot(vk::Device device, vk::CommandPool command_pool,
+                  vk::CommandPool                       transfer_command_pool,
+                  const std::vector<vkx::command_pool> &recording_command_pools,
+                  bool                                  separate_transfer)
+{
+    frame_slot slot;
+    slot.command_buffer = allocate_command_buffer(device, command_pool);
+    if (recording_command_pools.size() > 1)
+        for (const auto &recording_command_pool : recording_command_pools)
+        {
+            slot.secondary_command_buffers.push_back(allocate_command_buffer(
+                device, *recording_command_pool,
+                vk::CommandBufferLevel::eSecondary));
+            slot.secondary_command_buffer_handles.push_back(
+                *slot.secondary_command_buffers.back());
+        }
+    if (separate_transfer)
+    {
+        slot.transfer_command_buffer =
+            allocate_command_buffer(device, transfer_command_pool);
+        slot.rendered = vkx::create_semaphore(device);
+    }
+    return slot;
+}
+
+// (Re)creates the attachments, frame buffer and readback buffer of an idle
+// slot whenever the job's extent or color format differs from the last one
+// rendered in it.
+void prepare_frame_slot(frame_slot &slot, const vkx::memory_arena &memory_arena,
+                        const vkx::render_pass &render_pass,
+                        const render_job &      job)
+{
+    if (slot.width == job.width && slot.height == job.height &&
+        slot.format == job.format)
+        return;
+
+    // the old attachments go away below, a resize that fails halfway leaves
+    // the slot to be rebuilt by the next job. The recorded command buffers
+    // refer to the old frame buffer.
+    slot.width             = 0;
+    slot.height            = 0;
+    slot.format            = vk::Format::eUndefined;
+    slot.recorded_pipeline = nullptr;
+
+    auto device = memory_arena->get_device();
+
+    ////////////////////////////////////////////////////////////////
+    //  Color/Depth attachments
+    vk::ImageCreateInfo image_create_info_positions;
+    image_create_info_positions.setArrayLayers(1)
+        .setExtent(vk::Extent3D(job.width, job.height, 1))
+        .setFormat(job.format)
+        .setImageType(vk::ImageType::e2D)
+        .setInitialLayout(vk::ImageLayout::eUndefined)
+        .setMipLevels(1)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setSharingMode(vk::SharingMode::eExclusive)
+        .setTiling(vk::ImageTiling::eOptimal)
+        .setUsage(vk::ImageUsageFlagBits::eColorAttachment |
+                  vk::ImageUsageFlagBits::eTransferSrc);
+
+    slot.color_attachment =
+        vkx::image(device.createImage(image_create_info_positions),
+                   vkx::device_child_deleter{device});
+
+    slot.color_attachment_memory =
+        vkx::allocate(memory_arena, *slot.color_attachment);
+    vkx::bind(device, *slot.color_attachment, slot.color_attachment_memory);
+
+    vk::ImageSubresourceRange image_subresource_range_positions;
+    image_subresource_range_positions
+        .setAspectMask(vk::ImageAspectFlagBits::eColor)
+        .setBaseArrayLayer(0)
+        .setBaseMipLevel(0)
+        .setLayerCount(1)
+        .setLevelCount(1);
+
+    vk::ImageViewCreateInfo image_view_create_info_positions;
+    image_view_create_info_positions
+        .setFormat(image_create_info_positions.format)
+        .setImage(*slot.color_attachment)
+        .setViewType(vk::ImageViewType::e2D)
+        .setSubresourceRange(image_subresource_range_positions);
+
+    slot.color_attachment_view = vkx::image_view(
+        device.createImageView(image_view_create_info_positions),
+        vkx::device_child_deleter{device});
+
+    vk::ImageCreateInfo image_create_info_depth;
+    image_create_info_depth.setArrayLayers(1)
+        .setExtent(vk::Extent3D(job.width, job.height, 1))
+        .setFormat(vk::Format::eD32Sfloat)
+        .setImageType(vk::ImageType::e2D)
+        .setInitialLayout(vk::ImageLayout::eUndefined)
+        .setMipLevels(1)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setSharingMode(vk::SharingMode::eExclusive)
+        .setTiling(vk::ImageTiling::eOptimal)
+        .setUsage(vk::ImageUsageFlagBits::eDepthStencilAttachment);
+
+    slot.depth_attachment =
+        vkx::image(device.createImage(image_create_info_depth),
+                   vkx::device_child_deleter{device});
+
+    slot.depth_attachment_memory =
+        vkx::allocate(memory_arena, *slot.depth_attachment);
+    vkx::bind(device, *slot.depth_attachment, slot.depth_attachment_memory);
+
+    vk::ImageSubresourceRange image_subresource_range_depth;
+    image_subresource_range_depth.setAspectMask(vk::ImageAspectFlagBits::eDepth)
+        .setBaseArrayLayer(0)
+        .setBaseMipLevel(0)
+        .setLayerCount(1)
+        .setLevelCount(1);
+
+    vk::ImageViewCreateInfo image_view_create_info_depth;
+    image_view_create_info_depth.setFormat(image_create_info_depth.format)
+        .setImage(*slot.depth_attachment)
+        .setViewType(vk::ImageViewType::e2D)
+        .setSubresourceRange(image_subresource_range_depth);
+
+    slot.depth_attachment_view =
+        vkx::image_view(device.createImageView(image_view_create_info_depth),
+                        vkx::device_child_deleter{device});
+
+    ////////////////////////////////////////////////////////////////
+    //  Frame buffer
+    std::array<vk::ImageView, 2> image_views = {*slot.color_attachment_view,
+                                                *slot.depth_attachment_view};
+
+    vk::FramebufferCreateInfo framebuffer_create_info;
+    framebuffer_create_info.setAttachmentCount(uint32_t(image_views.size()))
+        .setPAttachments(image_views.data())
+        .setLayers(1)
+        .setRenderPass(*render_pass)
+        .setWidth(job.width)
+        .setHeight(job.height);
+
+    slot.frame_buffer =
+        vkx::frame_buffer(device.createFramebuffer(framebuffer_create_info),
+                          vkx::device_child_deleter{device});
+
+    ////////////////////////////////////////////////////////////////
+    //  Readback buffer
+    vk::BufferCreateInfo buffer_create_info;
+    buffer_create_info.setSharingMode(vk::SharingMode::eExclusive)
+        .setSize(vk::DeviceSize(job.width) * job.height *
+                 vkx::format_size(job.format))
+        .setUsage(vk::BufferUsageFlagBits::eTransferDst);
+    slot.position_map = vkx::buffer(device.createBuffer(buffer_create_info),
+                                    vkx::device_child_deleter{device});
+    slot.position_map_memory = vkx::allocate(memory_arena, *slot.position_map,
+                                             vkx::memory_usage::readback);
+    vkx::bind(device, *slot.position_map, slot.position_map_memory);
+
+    slot.width  = job.width;
+    slot.height = job.height;
+    slot.format = job.format;
+}
+
+// A render pass writing a color attachment of the given format that is left
+// ready to be copied out, and a depth attachment.
+vkx::render_pass create_render_pass(vk::Device device, vk::Format format)
+{
+    vk::AttachmentDescription attachment_description_position_rt;
+    attachment_description_position_rt
+        .setFormat(format)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setLoadOp(vk::AttachmentLoadOp::eClear)
+        .setStoreOp(vk::AttachmentStoreOp::eStore)
+        .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+        .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+        .setInitialLayout(vk::ImageLayout::eUndefined)
+        .setFinalLayout(vk::ImageLayout::eTransferSrcOptimal);
+
+    vk::AttachmentReference attachment_reference_position_rt;
+    attachment_reference_position_rt.setAttachment(0).setLayout(
+        vk::ImageLayout::eColorAttachmentOptimal);
+
+    vk::AttachmentDescription attachment_description_depth_rt;
+    attachment_description_depth_rt.setFormat(vk::Format::eD32Sfloat)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setLoadOp(vk::AttachmentLoadOp::eClear)
+        .setStoreOp(vk::AttachmentStoreOp::eStore)
+        .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+        .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+        .setInitialLayout(vk::ImageLayout::eUndefined)
+        .setFinalLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+    vk::AttachmentReference attachment_reference_depth_rt;
+    attachment_reference_depth_rt.setAttachment(1).setLayout(
+        vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+    vk::SubpassDescription subpass_description;
+    subpass_description
+        .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+        .setColorAttachmentCount(1)
+        .setPColorAttachments(&attachment_reference_position_rt)
+        .setPDepthStencilAttachment(&attachment_reference_depth_rt);
+
+    std::array<vk::SubpassDependency, 2> subpass_dependencies;
+    subpass_dependencies[0]
+        .setSrcSubpass(VK_SUBPASS_EXTERNAL)
+        .setDstSubpass(0)
+        .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+        .setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+        .setDstAccessMask(vk::AccessFlagBits::eColorAttachmentRead |
+                          vk::AccessFlagBits::eColorAttachmentWrite);
+
+    // the final layout transition feeds the readback copy recorded right
+    // after the render pass
+    subpass_dependencies[1]
+        .setSrcSubpass(0)
+        .setDstSubpass(VK_SUBPASS_EXTERNAL)
+        .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+        .setDstStageMask(vk::PipelineStageFlagBits::eTransfer)
+        .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+        .setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+
+    std::array<vk::AttachmentDescription, 2> attachments = {
+        attachment_description_position_rt,
+        attachment_description_depth_rt};
+
+    vk::RenderPassCreateInfo render_pass_create_info;
+    render_pass_create_info.setAttachmentCount(uint32_t(attachments.size()))
+        .setPAttachments(attachments.data())
+        .setSubpassCount(1)
+        .setPSubpasses(&subpass_description)
+        .setDependencyCount(uint32_t(subpass_dependencies.size()))
+        .setPDependencies(subpass_dependencies.data());
+    return vkx::render_pass(device.createRenderPass(render_pass_create_info),
+                            vkx::device_child_deleter{device});
+}
+
+vkx::pipeline create_pipeline(vk::Device                   device,
+                              const vkx::pipeline_cache & pipeline_cache,
+                              const vkx::pipeline_layout &pipeline_layout,
+                              const vkx::render_pass &    render_pass,
+                              const vkx::shader_module &  vertex_shader,
+                              const vkx::shader_module &  fragment_shader)
+{
+    std::array<vk::PipelineShaderStageCreateInfo, 2>
+        pipeline_shader_stage_create_infos;
+    pipeline_shader_stage_create_infos[0]
+        .setStage(vk::ShaderStageFlagBits::eVertex)
+        .setModule(*vertex_shader)
+        .setPName("main");
+    pipeline_shader_stage_create_infos[1]
+        .setStage(vk::ShaderStageFlagBits::eFragment)
+        .setModule(*fragment_shader)
+        .setPName("main");
+
+    vk::PipelineVertexInputStateCreateInfo
+        pipeline_vertex_input_state_create_info;
+
+    vk::PipelineInputAssemblyStateCreateInfo
+        pipeline_input_assembly_state_create_info;
+    pipeline_input_assembly_state_create_info
+        .setTopology(vk::PrimitiveTopology::eTriangleList)
+        .setPrimitiveRestartEnable(VK_FALSE);
+
+    // the extent is set per job so that one pipeline serves every
+    // resolution
+    vk::PipelineViewportStateCreateInfo pipeline_viewport_state_create_info;
+    pipeline_viewport_state_create_info.setViewportCount(1).setScissorCount(1);
+
+    std::array<vk::DynamicState, 2> dynamic_states = {
+        vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    vk::PipelineDynamicStateCreateInfo pipeline_dynamic_state_create_info;
+    pipeline_dynamic_state_create_info
+        .setDynamicStateCount(uint32_t(dynamic_states.size()))
+        .setPDynamicStates(dynamic_states.data());
+
+    vk::PipelineRasterizationStateCreateInfo
+        pipeline_rasterization_state_create_info;
+    pipeline_rasterization_state_create_info.setDepthClampEnable(VK_FALSE)
+        .setRasterizerDiscardEnable(VK_FALSE)
+        .setPolygonMode(vk::PolygonMode::eFill)
+        .setLineWidth(1.0f)
+        .setCullMode(vk::CullModeFlagBits::eBack)
+        .setFrontFace(vk::FrontFace::eClockwise)
+        .setDepthBiasEnable(VK_FALSE);
+
+    vk::PipelineMultisampleStateCreateInfo
+        pipeline_multisample_state_create_info;
+    pipeline_multisample_state_create_info.setSampleShadingEnable(VK_FALSE)
+        .setRasterizationSamples(vk::SampleCountFlagBits::e1);
+
+    vk::PipelineColorBlendAttachmentState
+        pipeline_color_blend_attachment_state;
+    pipeline_color_blend_attachment_state.setBlendEnable(VK_FALSE)
+        .setColorWriteMask(vk::ColorComponentFlagBits::eA |
+                           vk::ColorComponentFlagBits::eR |
+                           vk::ColorComponentFlagBits::eG |
+                           vk::ColorComponentFlagBits::eB);
+
+    vk::PipelineColorBlendStateCreateInfo
+        pipeline_color_blend_state_create_info;
+    pipeline_color_blend_state_create_info.setLogicOpEnable(VK_FALSE)
+        .setLogicOp(vk::LogicOp::eCopy)
+        .setAttachmentCount(1)
+        .setPAttachments(&pipeline_color_blend_attachment_state)
+        .setBlendConstants(std::array<float, 4>{0, 0, 0, 0});
+
+    vk::PipelineDepthStencilStateCreateInfo
+        pipeline_depth_stencil_state_create_info;
+    pipeline_depth_stencil_state_create_info
+        .setDepthCompareOp(vk::CompareOp::eLess)
+        .setDepthTestEnable(VK_TRUE)
+        .setDepthWriteEnable(VK_TRUE)
+        .setMinDepthBounds(0)
+        .setMaxDepthBounds(1);
+
+    vk::GraphicsPipelineCreateInfo graphics_pipeline_create_info;
+    graphics_pipeline_create_info.setLayout(*pipeline_layout)
+        .setPColorBlendState(&pipeline_color_blend_state_create_info)
+        .setPInputAssemblyState(&pipeline_input_assembly_state_create_info)
+        .setPMultisampleState(&pipeline_multisample_state_create_info)
+        .setPRasterizationState(&pipeline_rasterization_state_create_info)
+        .setStageCount(uint32_t(pipeline_shader_stage_create_infos.size()))
+        .setPStages(pipeline_shader_stage_create_infos.data())
+        .setPVertexInputState(&pipeline_vertex_input_state_create_info)
+        .setPViewportState(&pipeline_viewport_state_create_info)
+        .setPDepthStencilState(&pipeline_depth_stencil_state_create_info)
+        .setPDynamicState(&pipeline_dynamic_state_create_info)
+        .setRenderPass(*render_pass)
+        .setSubpass(0);
+    return vkx::pipeline(device.createGraphicsPipeline(
+                             *pipeline_cache, graphics_pipeline_create_info),
+                         vkx::device_child_deleter{device});
+}
+
+// Records the draws of meshes [first_mesh, last_mesh), instance_count
+// instances each. Secondary command buffers inherit no state, so everything
+// is bound again.
+void record_draw(vk::CommandBuffer                 command_buffer,
+                 const frame_slot &                slot,
+                 const color_pipeline &            color_pipeline,
+                 const vkx::pipeline_layout &      pipeline_layout,
+                 const draw_descriptors &          descriptors,
+                 std::vector<mesh>::const_iterator first_mesh,
+                 std::vector<mesh>::const_iterator last_mesh,
+                 uint32_t                          instance_count)
+{
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                                *color_pipeline.pipeline);
+
+    vk::Viewport viewport;
+    viewport.setX(0)
+        .setY(0)
+        .setWidth(float(slot.width))
+        .setHeight(float(slot.height))
+        .setMinDepth(0.0f)
+        .setMaxDepth(1.0f);
+    command_buffer.setViewport(0, {viewport});
+    command_buffer.setScissor(
+        0, {vk::Rect2D(vk::Offset2D(), vk::Extent2D(slot.width, slot.height))});
+
+    // meshes only differ in where they start in the geometry heap, and the
+    // slot's parameters live at a fixed offset, so the recording stays valid
+    // for every job with the same meshes rendered in it. Bindless, both sets
+    // are bound once and draws only set the index of their mesh.
+    pushed_descriptors pushed;
+    pushed.parameters.setBuffer(descriptors.parameters)
+        .setOffset(slot.parameters_offset)
+        .setRange(sizeof(job_parameters));
+    if (descriptors.meshes)
+    {
+        std::array<vk::DescriptorSet, 2> sets = {descriptors.set,
+                                                 descriptors.meshes};
+        command_buffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eGraphics, *pipeline_layout, 0, sets,
+            {uint32_t(slot.parameters_offset)});
+    }
+    for (auto mesh = first_mesh; mesh != last_mesh; ++mesh)
+    {
+        if (descriptors.meshes)
+            command_buffer.pushConstants(*pipeline_layout,
+                                         vk::ShaderStageFlagBits::eVertex, 0,
+                                         sizeof(mesh->index), &mesh->index);
+        else if (descriptors.push)
+        {
+            pushed.geometry.setBuffer(descriptors.geometry)
+                .setOffset(mesh->offset)
+                .setRange(mesh->size);
+            descriptors.push->push(command_buffer, &pushed);
+        }
+        else
+        {
+            std::array<uint32_t, 2> dynamic_offsets = {
+                uint32_t(mesh->offset), uint32_t(slot.parameters_offset)};
+            command_buffer.bindDescriptorSets(
+                vk::PipelineBindPoint::eGraphics, *pipeline_layout, 0,
+                {descriptors.set}, dynamic_offsets);
+        }
+
+        command_buffer.draw(mesh->vertex_count, instance_count, 0, 0);
+    }
+}
+
+// Records rendering into the slot's attachments followed by the readback of
+// the color attachment into the slot's host-visible buffer. With a separate
+// transfer family the readback goes to the slot's transfer command buffer and
+// the attachment changes hands between the two. When the slot has secondary
+// command buffers, the meshes are split between them in contiguous ranges,
+// which keeps the draws in order, and recorded by the workers in parallel.
+void record_frame(const frame_slot &          slot,
+                  const color_pipeline &      color_pipeline,
+                  const vkx::pipeline_layout &pipeline_layout,
+                  const draw_descriptors &    descriptors,
+                  const std::vector<mesh> &   meshes,
+                  const render_job &          job,
+                  const vkx::queue_set &      queues,
+                  vkx::worker_pool &          recording_workers)
+{
+    const auto &command_buffer = slot.command_buffer;
+
+    vk::CommandBufferBeginInfo command_buffer_begin_info;
+    command_buffer_begin_info.setFlags(
+        vk::CommandBufferUsageFlagBits::eSimultaneousUse);
+    command_buffer->begin(command_buffer_begin_info);
+    std::array<vk::ClearValue, 2> clear_values;
+    clear_values[0].setColor(vk::ClearColorValue());
+    clear_values[1].setDepthStencil(vk::ClearDepthStencilValue(1));
+    vk::RenderPassBeginInfo render_pass_begin_info;
+    vk::Rect2D render_area(vk::Offset2D(),
+                           vk::Extent2D(slot.width, slot.height));
+    render_pass_begin_info.setRenderPass(*color_pipeline.render_pass)
+        .setFramebuffer(*slot.frame_buffer)
+        .setRenderArea(render_area)
+        .setClearValueCount(uint32_t(clear_values.size()))
+        .setPClearValues(clear_values.data());
+
+    if (slot.secondary_command_buffers.empty())
+    {
+        command_buffer->beginRenderPass(render_pass_begin_info,
+                                        vk::SubpassContents::eInline);
+        record_draw(*command_buffer, slot, color_pipeline, pipeline_layout,
+                    descriptors, meshes.begin(), meshes.end(),
+                    job.instance_count);
+    }
+    else
+    {
+        vk::CommandBufferInheritanceInfo command_buffer_inheritance_info;
+        command_buffer_inheritance_info
+            .setRenderPass(*color_pipeline.render_pass)
+            .setSubpass(0)
+            .setFramebuffer(*slot.frame_buffer);
+        vk::CommandBufferBeginInfo secondary_begin_info;
+        secondary_begin_info
+            .setFlags(vk::CommandBufferUsageFlagBits::eRenderPassContinue |
+                      vk::CommandBufferUsageFlagBits::eSimultaneousUse)
+            .setPInheritanceInfo(&command_buffer_inheritance_info);
+
+        auto count = slot.secondary_command_buffers.size();
+        auto chunk = (meshes.size() + count - 1) / count;
+        recording_workers.run([&](size_t worker) {
+            const auto &secondary = slot.secondary_command_buffers[worker];
+            auto first = std::min(worker * chunk, meshes.size());
+            auto last  = std::min(first + chunk, meshes.size());
+
+            secondary->begin(secondary_begin_info);
+            if (first < last)
+                record_draw(*secondary, slot, color_pipeline, pipeline_layout,
+                            descriptors, meshes.begin() + ptrdiff_t(first),
+                            meshes.begin() + ptrdiff_t(last),
+                            job.instance_count);
+            secondary->end();
+        });
+
+        command_buffer->beginRenderPass(
+            render_pass_begin_info,
+            vk::SubpassContents::eSecondaryCommandBuffers);
+        command_buffer->executeCommands(slot.secondary_command_buffer_handles);
+    }
+    command_buffer->endRenderPass();
+
+    vk::CommandBuffer readback = *command_buffer;
+    if (queues.separate_transfer())
+    {
+        // the render pass already left the attachment in its transfer
+        // layout, so the release and acquire only move ownership. It never
+        // comes back, the next render pass discards the old contents.
+        vk::ImageSubresourceRange image_subresource_range;
+        image_subresource_range.setAspectMask(vk::ImageAspectFlagBits::eColor)
+            .setBaseArrayLayer(0)
+            .setLayerCount(1)
+            .setBaseMipLevel(0)
+            .setLevelCount(1);
+        vk::ImageMemoryBarrier ownership_transfer;
+        ownership_transfer.setOldLayout(vk::ImageLayout::eTransferSrcOptimal)
+            .setNewLayout(vk::ImageLayout::eTransferSrcOptimal)
+            .setSrcQueueFamilyIndex(queues.graphics_family)
+            .setDstQueueFamilyIndex(queues.transfer_family)
+            .setImage(*slot.color_attachment)
+            .setSubresourceRange(image_subresource_range);
+
+        // release
+        ownership_transfer.setSrcAccessMask(
+            vk::AccessFlagBits::eColorAttachmentWrite);
+        command_buffer->pipelineBarrier(
+            vk::PipelineStageFlagBits::eColorAttachmentOutput,
+            vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {},
+            {ownership_transfer});
+        command_buffer->end();
+
+        readback = *slot.transfer_command_buffer;
+        readback.begin(command_buffer_begin_info);
+
+        // acquire
+        ownership_transfer.setSrcAccessMask(vk::AccessFlags())
+            .setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+        readback.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                 vk::PipelineStageFlagBits::eTransfer, {}, {},
+                                 {}, {ownership_transfer});
+    }
+
+    vk::ImageSubresourceLayers image_subresource_layers;
+    image_subresource_layers.setAspectMask(vk::ImageAspectFlagBits::eColor)
+        .setBaseArrayLayer(0)
+        .setLayerCount(1)
+        .setMipLevel(0);
+    vk::BufferImageCopy buffer_image_copy;
+    buffer_image_copy.setBufferOffset(0)
+        .setBufferImageHeight(slot.height)
+        .setBufferRowLength(slot.width)
+        .setImageOffset(vk::Offset3D())
+        .setImageExtent(vk::Extent3D(slot.width, slot.height, 1))
+        .setImageSubresource(image_subresource_layers);
+    readback.copyImageToBuffer(*slot.color_attachment,
+                               vk::ImageLayout::eTransferSrcOptimal,
+                               *slot.position_map, {buffer_image_copy});
+
+    vk::BufferMemoryBarrier buffer_memory_barrier;
+    buffer_memory_barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+        .setDstAccessMask(vk::AccessFlagBits::eHostRead)
+        .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setBuffer(*slot.position_map)
+        .setOffset(0)
+        .setSize(VK_WHOLE_SIZE);
+    readback.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                             vk::PipelineStageFlagBits::eHost, {}, {},
+                             {buffer_memory_barrier}, {});
+
+    readback.end();
+}
+}
+
+renderer::renderer(size_t frames_in_flight, size_t recording_threads,
+                   size_t                    jobs_per_submit,
+                   std::chrono::microseconds max_submit_delay,
+                   size_t                    device_index,
+                   descriptor_model          preferred_descriptors)
+    : recording_workers(recording_threads)
+{
+    ////////////////////////////////////////////////////////////////
+    //  Instance
+
+    std::vector<const char *> extensions = {
+        VK_EXT_DEBUG_REPORT_EXTENSION_NAME};
+
+    // VK_KHR_push_descriptor and VK_EXT_descriptor_indexing depend on it
+    bool properties2 =
+        preferred_descriptors != descriptor_model::bound &&
+        vkx::has_extension(
+            vk::enumerateInstanceExtensionProperties(),
+            VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    if (properties2)
+        extensions.push_back(
+            VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
+    vk::InstanceCreateInfo instanceCreateInfo;
+    instanceCreateInfo.setEnabledExtensionCount(uint32_t(extensions.size()))
+        .setPpEnabledExtensionNames(extensions.data());
+
+    auto layers = []() {
+        static const std::array<const char *, 1> layers = {
+            "VK_LAYER_LUNARG_standard_validation",
+            //"VK_LAYER_LUNARG_api_dump"
+        };
+        return layers;
+    }();
+
+    instanceCreateInfo.setEnabledLayerCount(uint32_t(layers.size()))
+        .setPpEnabledLayerNames(layers.data());
+
+    vkx::instance instance(vk::createInstance(instanceCreateInfo));
+
+    ////////////////////////////////////////////////////////////////
+    //  Debugging callback
+    vk::DebugReportCallbackCreateInfoEXT dInfo;
+    dInfo
+        .setFlags(vk::DebugReportFlagBitsEXT::eDebug |
+                  vk::DebugReportFlagBitsEXT::eError |
+                  vk::DebugReportFlagBitsEXT::eInformation |
+                  vk::DebugReportFlagBitsEXT::ePerformanceWarning |
+                  vk::DebugReportFlagBitsEXT::eWarning)
+        .setPfnCallback(vkx::log);
+
+    auto vkCreateDebugReportCallbackEXT =
+        (PFN_vkCreateDebugReportCallbackEXT)instance->getProcAddr(
+            "vkCreateDebugReportCallbackEXT");
+    vk::DebugReportCallbackEXT callback;
+    vk::Result                 result =
+        static_cast<vk::Result>(vkCreateDebugReportCallbackEXT(
+            *instance,
+            reinterpret_cast<const VkDebugReportCallbackCreateInfoEXT *>(
+                &dInfo),
+            nullptr,
+            reinterpret_cast<VkDebugReportCallbackEXT *>(&callback)));
+    vkx::debug_report_callback_ext debug_report_callback_ext(
+        vk::createResultValue(result, callback,
+                              "vk::Instance::createDebugReportCallbackEXT"),
+        vkx::debug_report_callback_deleter{*instance});
+
+    ////////////////////////////////////////////////////////////////
+    //  Logical device
+    auto physical_devices = vkx::find_physical_devices(*instance);
+    vkx::physical_device physical_device =
+        physical_devices[device_index % physical_devices.size()];
+    if (vkx::verbose())
+        std::cout << "physical device: "
+                  << physical_device.getProperties().deviceName << std::endl;
+
+    // queried once, render() checks every job against them
+    vk::PhysicalDeviceLimits limits = physical_device.getProperties().limits;
+
+    vkx::queue_set queues = vkx::find_queue_families(physical_device);
+    if (vkx::verbose())
+        std::cout << "transfer queue: "
+                  << (queues.separate_transfer() ? "dedicated" : "shared")
+                  << std::endl;
+
+    static const float queue_priorities[] = {1.0f};
+
+    std::array<vk::DeviceQueueCreateInfo, 2> device_queue_create_infos;
+    device_queue_create_infos[0]
+        .setQueueFamilyIndex(queues.graphics_family)
+        .setQueueCount(1)
+        .setPQueuePriorities(queue_priorities);
+    device_queue_create_infos[1]
+        .setQueueFamilyIndex(queues.transfer_family)
+        .setQueueCount(1)
+        .setPQueuePriorities(queue_priorities);
+
+    auto     model             = preferred_descriptors;
+    uint32_t bindless_capacity = 0;
+    if (model == descriptor_model::bindless && properties2 &&
+        vkx::supports_descriptor_indexing(*instance, physical_device))
+        bindless_capacity = std::min(
+            max_bindless_meshes, vkx::max_update_after_bind_storage_buffers(
+                                     *instance, physical_device));
+    if (model == descriptor_model::bindless &&
+        bindless_capacity < min_bindless_meshes)
+        model = descriptor_model::pushed;
+    if (model == descriptor_model::pushed &&
+        !(properties2 && vkx::supports_push_descriptors(physical_device)))
+        model = descriptor_model::bound;
+    if (vkx::verbose())
+        std::cout << "descriptors: " << to_string(model) << std::endl;
+
+    vk::PhysicalDeviceFeatures                      physical_device_features;
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features;
+    vk::DeviceCreateInfo                            device_info;
+    std::vector<const char *>                       device_extensions;
+    if (model == descriptor_model::pushed)
+        device_extensions = {VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
+                             VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME};
+    else if (model == descriptor_model::bindless)
+    {
+        device_extensions = {VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+                             VK_KHR_MAINTENANCE3_EXTENSION_NAME};
+        physical_device_features.setShaderStorageBufferArrayDynamicIndexing(
+            VK_TRUE);
+        indexing_features.setRuntimeDescriptorArray(VK_TRUE)
+            .setDescriptorBindingPartiallyBound(VK_TRUE)
+            .setDescriptorBindingStorageBufferUpdateAfterBind(VK_TRUE)
+            .setDescriptorBindingUpdateUnusedWhilePending(VK_TRUE);
+        device_info.setPNext(&indexing_features);
+    }
+
+    device_info
+        .setQueueCreateInfoCount(queues.separate_transfer() ? 2 : 1)
+        .setPQueueCreateInfos(device_queue_create_infos.data())
+        .setEnabledExtensionCount(uint32_t(device_extensions.size()))
+        .setPpEnabledExtensionNames(device_extensions.data())
+        .setPEnabledFeatures(&physical_device_features);
+    vkx::device device(physical_device.createDevice(device_info));
+
+    ////////////////////////////////////////////////////////////////
+    //  Memory arena
+    vkx::memory_arena memory_arena =
+        vkx::create_memory_arena(*device, physical_device);
+
+    ////////////////////////////////////////////////////////////////
+    //  Command pools
+    vk::CommandPoolCreateInfo command_pool_create_info;
+    command_pool_create_info.setQueueFamilyIndex(queues.graphics_family)
+        .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+    vkx::command_pool command_pool(
+        device->createCommandPool(command_pool_create_info),
+        vkx::device_child_deleter{*device});
+
+    command_pool_create_info.setQueueFamilyIndex(queues.transfer_family);
+    vkx::command_pool transfer_command_pool(
+        device->createCommandPool(command_pool_create_info),
+        vkx::device_child_deleter{*device});
+
+    // command pools are externally synchronized, so every recording thread
+    // gets its own
+    command_pool_create_info.setQueueFamilyIndex(queues.graphics_family);
+    std::vector<vkx::command_pool> recording_command_pools;
+    for (size_t i = 0; i < recording_workers.size(); ++i)
+        recording_command_pools.emplace_back(
+            device->createCommandPool(command_pool_create_info),
+            vkx::device_child_deleter{*device});
+
+    ////////////////////////////////////////////////////////////////
+    //  Queues
+    queues.graphics = device->getQueue(queues.graphics_family, 0);
+    queues.transfer = device->getQueue(queues.transfer_family, 0);
+
+    ////////////////////////////////////////////////////////////////
+    //  Staging ring
+    vkx::staging_ring staging_ring = vkx::create_staging_ring(
+        *device, physical_device.getMemoryProperties(), queues);
+
+    ////////////////////////////////////////////////////////////////
+    //  Pipeline cache
+    vkx::pipeline_cache pipeline_cache =
+        vkx::create_pipeline_cache(*device, physical_device);
+
+    ////////////////////////////////////////////////////////////////
+    //  Shaders
+    // bindless draws read their positions from an array of buffers
+#ifdef VKX_EMBEDDED_SHADERS
+    vkx::shader_module vertex_shader =
+        model == descriptor_model::bindless
+            ? vkx::create_shader(*device, shaders::offscreen_bindless_vert)
+            : vkx::create_shader(*device, shaders::offscreen_vert);
+    vkx::shader_module fragment_shader =
+        vkx::create_shader(*device, shaders::offscreen_frag);
+#else
+    vkx::spirv_cache spirv_cache = vkx::create_spirv_cache();
+
+    vkx::shader_module vertex_shader = vkx::create_shader(
+        *device, vk::ShaderStageFlagBits::eVertex,
+        vkx::load_text_file(model == descriptor_model::bindless
+                                ? VKX_SHADER_DIR "offscreen_bindless.vert"
+                                : VKX_SHADER_DIR "offscreen.vert"),
+        spirv_cache);
+
+    vkx::shader_module fragment_shader = vkx::create_shader(
+        *device, vk::ShaderStageFlagBits::eFragment,
+        vkx::load_text_file(VKX_SHADER_DIR "offscreen.frag"), spirv_cache);
+
+    if (vkx::verbose())
+        std::cout << "spir-v cache hits: " << spirv_cache->hit_count()
+                  << ", misses: " << spirv_cache->miss_count()
+                  << ", saved: " << spirv_cache->saved_milliseconds()
+                  << " ms" << std::endl;
+#endif
+
+    ////////////////////////////////////////////////////////////////
+    //  Pipeline
+
+    // job parameters come from a uniform buffer rather than push constants,
+    // so that recorded command buffers can be replayed for new jobs. Pushed
+    // descriptors can not be dynamic, each draw pushes its ranges instead.
+    // Bindless, set 0 only holds the parameters and the meshes are in set 1,
+    // as dynamic buffers can not share a set with update after bind.
+    std::vector<vk::DescriptorType> descriptor_types;
+    switch (model)
+    {
+    case descriptor_model::bound:
+        descriptor_types = {vk::DescriptorType::eStorageBufferDynamic,
+                            vk::DescriptorType::eUniformBufferDynamic};
+        break;
+    case descriptor_model::pushed:
+        descriptor_types = {vk::DescriptorType::eStorageBuffer,
+                            vk::DescriptorType::eUniformBuffer};
+        break;
+    case descriptor_model::bindless:
+        descriptor_types = {vk::DescriptorType::eUniformBufferDynamic};
+        break;
+    }
+
+    std::vector<vk::DescriptorSetLayoutBinding> descriptor_set_layout_bindings(
+        descriptor_types.size());
+    for (uint32_t i = 0; i < descriptor_types.size(); ++i)
+        descriptor_set_layout_bindings[i]
+            .setBinding(i)
+            .setDescriptorCount(1)
+            .setDescriptorType(descriptor_types[i])
+            .setStageFlags(vk::ShaderStageFlagBits::eVertex);
+
+    vk::DescriptorSetLayoutCreateInfo descriptor_set_layout_create_info;
+    descriptor_set_layout_create_info
+        .setBindingCount(uint32_t(descriptor_set_layout_bindings.size()))
+        .setPBindings(descriptor_set_layout_bindings.data());
+    if (model == descriptor_model::pushed)
+        descriptor_set_layout_create_info.setFlags(
+            vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR);
+    vkx::descriptor_set_layout descriptor_set_layout(
+        device->createDescriptorSetLayout(descriptor_set_layout_create_info),
+        vkx::device_child_deleter{*device});
+
+    std::vector<vk::DescriptorSetLayout> set_layouts = {
+        *descriptor_set_layout};
+    vkx::storage_buffer_array mesh_descriptors;
+    vk::PushConstantRange     mesh_index_range;
+    mesh_index_range.setStageFlags(vk::ShaderStageFlagBits::eVertex)
+        .setOffset(0)
+        .setSize(sizeof(uint32_t));
+
+    vk::PipelineLayoutCreateInfo pipeline_layout_create_info;
+    if (model == descriptor_model::bindless)
+    {
+        mesh_descriptors = vkx::storage_buffer_array(
+            *device, bindless_capacity, vk::ShaderStageFlagBits::eVertex);
+        set_layouts.push_back(mesh_descriptors.get_layout());
+        pipeline_layout_create_info.setPushConstantRangeCount(1)
+            .setPPushConstantRanges(&mesh_index_range);
+    }
+    pipeline_layout_create_info
+        .setSetLayoutCount(uint32_t(set_layouts.size()))
+        .setPSetLayouts(set_layouts.data());
+
+    vkx::pipeline_layout pipeline_layout(
+        device->createPipelineLayout(pipeline_layout_create_info),
+        vkx::device_child_deleter{*device});
+
+    // draws push a pushed_descriptors, whose members are read as one
+    // descriptor each
+    vkx::descriptor_push_template descriptor_push;
+    if (model == descriptor_model::pushed)
+    {
+        std::array<vk::DescriptorUpdateTemplateEntryKHR, 2> entries;
+        entries[0]
+            .setDstBinding(0)
+            .setDstArrayElement(0)
+            .setDescriptorCount(1)
+            .setDescriptorType(descriptor_types[0])
+            .setOffset(offsetof(pushed_descriptors, geometry))
+            .setStride(sizeof(vk::DescriptorBufferInfo));
+        entries[1]
+            .setDstBinding(1)
+            .setDstArrayElement(0)
+            .setDescriptorCount(1)
+            .setDescriptorType(descriptor_types[1])
+            .setOffset(offsetof(pushed_descriptors, parameters))
+            .setStride(sizeof(vk::DescriptorBufferInfo));
+        descriptor_push = vkx::descriptor_push_template(
+            *device, *descriptor_set_layout, *pipeline_layout, 0, entries);
+    }
+
+    ////////////////////////////////////////////////////////////////
+    //  Render pass and pipeline for the default color format
+    color_pipeline default_color_pipeline;
+    default_color_pipeline.render_pass =
+        create_render_pass(*device, render_job().format);
+    default_color_pipeline.pipeline = create_pipeline(
+        *device, pipeline_cache, pipeline_layout,
+        default_color_pipeline.render_pass, vertex_shader, fragment_shader);
+
+    ////////////////////////////////////////////////////////////////
+    //  Geometry heap, which every mesh is sub-allocated from
+    vkx::geometry_heap geometry(
+        memory_arena, geometry_capacity,
+        model == descriptor_model::bound ? bound_geometry_range : 0,
+        limits.minStorageBufferOffsetAlignment);
+
+    ////////////////////////////////////////////////////////////////
+    //  Job parameters dynamic uniform buffer, one range per frame slot
+    if (frames_in_flight == 0)
+        throw std::runtime_error("at least one frame must be in flight");
+
+    auto parameters_alignment = limits.minUniformBufferOffsetAlignment;
+    auto parameters_stride =
+        (sizeof(job_parameters) + parameters_alignment - 1) /
+        parameters_alignment * parameters_alignment;
+
+    vk::BufferCreateInfo parameters_create_info;
+    parameters_create_info.setSharingMode(vk::SharingMode::eExclusive)
+        .setSize(parameters_stride * frames_in_flight)
+        .setUsage(vk::BufferUsageFlagBits::eUniformBuffer);
+    vkx::bound_buffer parameters;
+    parameters.buffer =
+        vkx::buffer(device->createBuffer(parameters_create_info),
+                    vkx::device_child_deleter{*device});
+    parameters.memory = vkx::allocate(memory_arena, *parameters.buffer,
+                                      vkx::memory_usage::upload);
+    vkx::bind(*device, *parameters.buffer, parameters.memory);
+
+    ////////////////////////////////////////////////////////////////
+    //  Frame slots
+    for (size_t i = 0; i < frames_in_flight; ++i)
+    {
+        frame_slots.push_back(
+            create_frame_slot(*device, *command_pool, *transfer_command_pool,
+                              recording_command_pools,
+                              queues.separate_transfer()));
+        frame_slots.back().parameters_offset = i * parameters_stride;
+        if (model != descriptor_model::pushed)
+            frame_slots.back().descriptor_sets = vkx::descriptor_set_cache(
+                *device, *descriptor_set_layout, descriptor_types);
+    }
+
+    this->instance                  = std::move(instance);
+    this->debug_report_callback_ext = std::move(debug_report_callback_ext);
+    this->physical_device           = std::move(physical_device);
+    this->limits                    = limits;
+    this->device                    = std::move(device);
+    this->memory_arena              = std::move(memory_arena);
+    this->staging_ring              = std::move(staging_ring);
+    this->command_pool              = std::move(command_pool);
+    this->transfer_command_pool     = std::move(transfer_command_pool);
+    this->recording_command_pools   = std::move(recording_command_pools);
+    this->queues                    = queues;
+    this->pipeline_cache            = std::move(pipeline_cache);
+    this->descriptor_set_layout     = std::move(descriptor_set_layout);
+    this->pipeline_layout           = std::move(pipeline_layout);
+    this->descriptor_push           = std::move(descriptor_push);
+    this->mesh_descriptors          = std::move(mesh_descriptors);
+    this->active_descriptor_model   = model;
+    this->vertex_shader             = std::move(vertex_shader);
+    this->fragment_shader           = std::move(fragment_shader);
+    this->geometry                  = std::move(geometry);
+    this->parameters                = std::move(parameters);
+
+    color_pipelines[render_job().format] = std::move(default_color_pipeline);
+
+    default_meshes = {create_mesh({glm::vec2(0.0, -0.5), glm::vec2(0.5, 0.5),
+                                   glm::vec2(-0.5, 0.5)})};
+
+    graphics_batch.reset(new vkx::submit_batch(
+        *this->device, queues.graphics, jobs_per_submit, max_submit_delay));
+    transfer_batch.reset(new vkx::submit_batch(
+        *this->device, queues.transfer, jobs_per_submit, max_submit_delay));
+}
+
+size_t count_physical_devices()
+{
+    vkx::instance instance(vk::createInstance(vk::InstanceCreateInfo()));
+    return vkx::find_physical_devices(*instance).size();
+}
+
+render_result renderer::render(const render_job &job)
+{
+    render_result result;
+    result.width  = job.width;
+    result.height = job.height;
+    result.format = job.format;
+
+    render(job, [&result](const void *pixels, size_t size) {
+        auto begin = static_cast<const char *>(pixels);
+        result.pixels.assign(begin, begin + size);
+    });
+    flush();
+
+    return result;
+}
+
+void renderer::render(const render_job &job, frame_callback on_frame)
+{
+    if (job.width == 0 || job.height == 0 ||
+        job.width > limits.maxFramebufferWidth ||
+        job.height > limits.maxFramebufferHeight)
+        throw std::runtime_error("unsupported output resolution " +
+                                 std::to_string(job.width) + "x" +
+                                 std::to_string(job.height));
+
+    const auto &color_pipeline = get_color_pipeline(job.format);
+
+    auto &slot = frame_slots[next_slot];
+    next_slot  = (next_slot + 1) % frame_slots.size();
+
+    // the previous occupant of this slot is the oldest frame in flight
+    if (slot.in_flight)
+    {
+        try
+        {
+            retire(slot);
+        }
+        catch (...)
+        {
+            abandon_frames();
+            throw;
+        }
+    }
+
+    prepare_frame_slot(slot, memory_arena, color_pipeline.render_pass, job);
+
+    job_parameters padded;
+    for (size_t i = 0; i < job.constants.size(); ++i)
+        padded.colors[i] = glm::vec4(job.constants[i], 0.0f);
+    std::memcpy(static_cast<char *>(parameters.memory->mapped) +
+                    slot.parameters_offset,
+                &padded, sizeof(padded));
+    vkx::flush(*device, parameters.memory);
+
+    draw_descriptors descriptors;
+    descriptors.geometry   = geometry.get_buffer();
+    descriptors.parameters = *parameters.buffer;
+    if (descriptor_push)
+        descriptors.push = &descriptor_push;
+    else
+    {
+        // the slot is idle, so its descriptor set cache may reset its pool.
+        // Binding the same buffers as last time is a lookup.
+        std::array<vk::DescriptorBufferInfo, 2> buffers;
+        buffers[0].setBuffer(geometry.get_buffer()).setOffset(0).setRange(
+            geometry.get_max_range());
+        buffers[1].setBuffer(*parameters.buffer).setOffset(0).setRange(
+            sizeof(job_parameters));
+        if (mesh_descriptors)
+        {
+            descriptors.meshes = mesh_descriptors.get_set();
+            descriptors.set    = slot.descriptor_sets.get(buffers[1]);
+        }
+        else
+            descriptors.set = slot.descriptor_sets.get(buffers);
+    }
+
+    const auto &meshes = job.meshes.empty() ? default_meshes : job.meshes;
+
+    // jobs that only differ in their constants replay what the slot has
+    // recorded already
+    if (slot.recorded_pipeline != &color_pipeline ||
+        slot.recorded_instance_count != job.instance_count ||
+        slot.recorded_descriptor_set != descriptors.set ||
+        slot.recorded_meshes != meshes)
+    {
+        // a recording that fails halfway must not be replayed
+        slot.recorded_pipeline = nullptr;
+        slot.recorded_meshes.clear();
+
+        auto recording_start = std::chrono::steady_clock::now();
+        record_frame(slot, color_pipeline, pipeline_layout, descriptors,
+                     meshes, job, queues, recording_workers);
+        recording_seconds +=
+            std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          recording_start)
+                .count();
+        recorded_draws += meshes.size();
+        slot.recorded_pipeline       = &color_pipeline;
+        slot.recorded_instance_count = job.instance_count;
+        slot.recorded_descriptor_set = descriptors.set;
+        slot.recorded_meshes         = meshes;
+    }
+    slot.on_frame = std::move(on_frame);
+
+    try
+    {
+        queue_frame(slot);
+    }
+    catch (...)
+    {
+        // the caller reports the failure, the slot must not call back later
+        slot.on_frame = nullptr;
+        throw;
+    }
+}
+
+// Adds the command buffers of a recorded slot to the batches, which are
+// submitted once due.
+void renderer::queue_frame(frame_slot &slot)
+{
+    if (queues.separate_transfer())
+    {
+        // the fence of the readback also covers the rendering it waits for,
+        // but the rendering token has to live until then as well because
+        // destroying the last reference waits for its fence
+        slot.rendering = graphics_batch->add(
+            *slot.command_buffer, vk::Semaphore(), vk::PipelineStageFlags(),
+            *slot.rendered);
+        slot.in_flight = transfer_batch->add(
+            *slot.transfer_command_buffer, *slot.rendered,
+            vk::PipelineStageFlagBits::eTransfer);
+    }
+    else
+        slot.in_flight = graphics_batch->add(*slot.command_buffer);
+
+    if (graphics_batch->due() || transfer_batch->due())
+        submit_pending();
+}
+
+mesh renderer::create_mesh(const std::vector<glm::vec2> &positions)
+{
+    mesh created;
+    created.size         = positions.size() * sizeof(glm::vec2);
+    created.vertex_count = uint32_t(positions.size());
+    created.offset       = geometry.allocate(created.size);
+    uploading            = vkx::upload(*device, staging_ring, queues,
+                                       geometry.get_buffer(), created.offset,
+                                       positions.data(), size_t(created.size));
+    if (mesh_descriptors)
+    {
+        vk::DescriptorBufferInfo buffer;
+        buffer.setBuffer(geometry.get_buffer())
+            .setOffset(created.offset)
+            .setRange(created.size);
+        try
+        {
+            created.index = mesh_descriptors.add(buffer);
+        }
+        catch (...)
+        {
+            geometry.free(created.offset, created.size);
+            throw;
+        }
+    }
+    return created;
+}
+
+void renderer::destroy_mesh(const mesh &destroyed)
+{
+    if (mesh_descriptors)
+        mesh_descriptors.remove(destroyed.index);
+    geometry.free(destroyed.offset, destroyed.size);
+}
+
+void renderer::poll()
+{
+    try
+    {
+        if (graphics_batch->due() || transfer_batch->due())
+            submit_pending();
+
+        // frames finish in the order they were queued, the oldest come first
+        for (size_t i = 0; i < frame_slots.size(); ++i)
+        {
+            auto &slot = frame_slots[(next_slot + i) % frame_slots.size()];
+            if (!slot.in_flight)
+                continue;
+            if (!slot.in_flight->ready())
+                break;
+            retire(slot);
+        }
+    }
+    catch (...)
+    {
+        abandon_frames();
+        throw;
+    }
+}
+
+void renderer::flush()
+{
+    try
+    {
+        submit_pending();
+        for (size_t i = 0; i < frame_slots.size(); ++i)
+        {
+            auto &slot = frame_slots[(next_slot + i) % frame_slots.size()];
+            if (slot.in_flight)
+                retire(slot);
+        }
+
+        // uploads complete in submission order, the last one covers them all
+        if (uploading)
+        {
+            uploading->wait();
+            uploading.reset();
+        }
+    }
+    catch (...)
+    {
+        abandon_frames();
+        throw;
+    }
+}
+
+// After waiting for a frame failed, the frames still in flight are handed
+// out as failures, oldest first, so that nobody waits for their pixels.
+void renderer::abandon_frames()
+{
+    for (size_t i = 0; i < frame_slots.size(); ++i)
+    {
+        auto &slot = frame_slots[(next_slot + i) % frame_slots.size()];
+
+        auto on_frame = std::move(slot.on_frame);
+        slot.on_frame = nullptr;
+        slot.in_flight.reset();
+        slot.rendering.reset();
+        if (on_frame)
+            on_frame(nullptr, 0);
+    }
+}
+
+vk::MemoryPropertyFlags renderer::get_readback_memory_flags() const
+{
+    const auto &memory = frame_slots.front().position_map_memory;
+    return memory ? memory->flags : vk::MemoryPropertyFlags();
+}
+
+const color_pipeline &renderer::get_color_pipeline(vk::Format format)
+{
+    auto found = color_pipelines.find(format);
+    if (found != color_pipelines.end())
+        return found->second;
+
+    // throws for formats we don't know the texel size of
+    vkx::format_size(format);
+
+    auto properties = physical_device.getFormatProperties(format);
+    if (!(properties.optimalTilingFeatures &
+          vk::FormatFeatureFlagBits::eColorAttachment))
+        throw std::runtime_error("can not render to " +
+                                 vk::to_string(format));
+
+    color_pipeline created;
+    created.render_pass = create_render_pass(*device, format);
+    created.pipeline =
+        create_pipeline(*device, pipeline_cache, pipeline_layout,
+                        created.render_pass, vertex_shader, fragment_shader);
+    return color_pipelines[format] = std::move(created);
+}
+
+// The graphics batch goes first, the transfer batch waits for the semaphores
+// it signals.
+void renderer::submit_pending()
+{
+    graphics_batch->submit();
+    transfer_batch->submit();
+}
+
+size_t renderer::get_descriptor_update_count() const
+{
+    size_t count = 0;
+    for (const auto &slot : frame_slots)
+        count += slot.descriptor_sets.update_count();
+    return count;
+}
+
+size_t renderer::get_submit_count() const
+{
+    return graphics_batch->submit_count() + transfer_batch->submit_count();
+}
+
+void renderer::retire(frame_slot &slot)
+{
+    if (graphics_batch->holds(slot.in_flight) ||
+        transfer_batch->holds(slot.in_flight) || graphics_batch->due() ||
+        transfer_batch->due())
+        submit_pending();
+
+    // the readback waited for the rendering, so neither blocks any further
+    slot.in_flight->wait();
+    slot.in_flight.reset();
+    slot.rendering.reset();
+
+    auto on_frame = std::move(slot.on_frame);
+    slot.on_frame = nullptr;
+    if (!on_frame)
+        return;
+
+    auto size = vk::DeviceSize(slot.width) * slot.height *
+                vkx::format_size(slot.format);
+    vkx::invalidate(*device, slot.position_map_memory);
+    on_frame(slot.position_map_memory->mapped, size_t(size));
+}
+}
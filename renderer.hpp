@@ -0,0 +1,252 @@
+#pragma once
+
+#include "vkx.hpp"
+#include <glm/glm.hpp>
+
+namespace vkx
+{
+using job_constants = std::array<glm::vec3, 16>;
+
+// How draws find their vertex positions and job parameters, from the most
+// widely supported way to the one with the least CPU work per draw.
+enum class descriptor_model
+{
+    // cached sets with dynamic offsets, bound for every draw
+    bound,
+    // pushed into the command buffer for every draw
+    pushed,
+    // every mesh in one descriptor array bound once per frame, draws pick
+    // theirs by a push constant
+    bindless
+};
+
+inline const char *to_string(descriptor_model model)
+{
+    switch (model)
+    {
+    case descriptor_model::bound:
+        return "bound";
+    case descriptor_model::pushed:
+        return "pushed";
+    case descriptor_model::bindless:
+        return "bindless";
+    }
+    return "unknown";
+}
+
+// Vertex positions in the renderer's geometry heap
+struct mesh
+{
+    vk::DeviceSize offset       = 0;
+    vk::DeviceSize size         = 0;
+    uint32_t       vertex_count = 0;
+    // element of the renderer's mesh descriptor array, when bindless
+    uint32_t index = 0;
+
+    bool operator==(const mesh &other) const
+    {
+        return offset == other.offset && size == other.size &&
+               vertex_count == other.vertex_count && index == other.index;
+    }
+    bool operator!=(const mesh &other) const { return !(*this == other); }
+};
+
+// Jobs that only differ in their constants replay the command buffers
+// recorded for the previous job in the same slot.
+struct render_job
+{
+    job_constants constants;
+    uint32_t      instance_count = 10000;
+    uint32_t      width          = 512;
+    uint32_t      height         = 512;
+    vk::Format    format         = vk::Format::eR32G32B32A32Sfloat;
+    // each drawn instance_count times, a single triangle when empty
+    std::vector<vkx::mesh> meshes;
+};
+
+// Tightly packed pixels in the job's format, row by row
+struct render_result
+{
+    uint32_t          width;
+    uint32_t          height;
+    vk::Format        format;
+    std::vector<char> pixels;
+};
+
+// Receives the pixels of a finished job. The pointer is only valid for the
+// duration of the call.
+using frame_callback = std::function<void(const void *pixels, size_t size)>;
+
+// The render pass and pipeline for one color format. Viewport and scissor are
+// dynamic, so jobs of any resolution share them.
+struct color_pipeline
+{
+    vkx::render_pass render_pass;
+    vkx::pipeline    pipeline;
+};
+
+// Everything a frame needs while it is in flight, so that several frames can
+// be rendered, read back and written out concurrently.
+struct frame_slot
+{
+    vkx::image                       color_attachment;
+    vkx::allocation                  color_attachment_memory;
+    vkx::image_view                  color_attachment_view;
+    vkx::image                       depth_attachment;
+    vkx::allocation                  depth_attachment_memory;
+    vkx::image_view                  depth_attachment_view;
+    vkx::frame_buffer                frame_buffer;
+    vkx::buffer                      position_map;
+    vkx::allocation                  position_map_memory;
+    vkx::command_buffer              command_buffer;
+    vkx::command_buffer              transfer_command_buffer;
+    std::vector<vkx::command_buffer> secondary_command_buffers;
+    std::vector<vk::CommandBuffer>   secondary_command_buffer_handles;
+    vkx::semaphore                   rendered;
+    vkx::descriptor_set_cache        descriptor_sets;
+    vk::DeviceSize                   parameters_offset       = 0;
+    const vkx::color_pipeline *      recorded_pipeline       = nullptr;
+    uint32_t                         recorded_instance_count = 0;
+    vk::DescriptorSet                recorded_descriptor_set;
+    std::vector<vkx::mesh>           recorded_meshes;
+    vkx::frame_callback              on_frame;
+    vkx::completion_token            in_flight;
+    // the rendering, when the readback goes to a separate transfer queue
+    vkx::completion_token            rendering;
+    uint32_t                         width  = 0;
+    uint32_t                         height = 0;
+    vk::Format                       format = vk::Format::eUndefined;
+};
+
+// Number of physical devices a renderer can run on, see find_physical_devices.
+size_t count_physical_devices();
+
+// Keeps the instance, device, pools, pipeline and a ring of frame slots alive
+// so that any number of jobs can be rendered without paying for Vulkan
+// initialization again.
+class renderer
+{
+  public:
+    // Jobs are recorded by recording_threads threads, including the calling
+    // one, that split the meshes of a job between them. Jobs are submitted
+    // in batches of up to jobs_per_submit, or whatever is pending once the
+    // oldest of them waited max_submit_delay. The renderer has no thread of its
+    // own, the delay is checked whenever a job is rendered or a slot retired,
+    // so callers that stop rendering call flush(). Batches can not grow beyond
+    // frames_in_flight, as reusing a slot submits its job. Rendering happens on
+    // the device_index-th best suitable physical device, counting around, so
+    // that several renderers can share a device. Draws get their descriptors
+    // the preferred_descriptors way if the device supports it, falling back
+    // from bindless to pushed to bound otherwise.
+    explicit renderer(size_t frames_in_flight  = 3,
+                      size_t recording_threads = 1, size_t jobs_per_submit = 1,
+                      std::chrono::microseconds max_submit_delay =
+                          std::chrono::milliseconds(2),
+                      size_t           device_index = 0,
+                      descriptor_model preferred_descriptors =
+                          descriptor_model::bindless);
+
+    renderer(const renderer &) = delete;
+    renderer &operator=(const renderer &) = delete;
+
+    // Renders job and waits for its pixels.
+    render_result render(const render_job &job);
+
+    // Queues job behind the frames already in flight. Callbacks run in
+    // submission order, when their slot is reused, from poll() or from
+    // flush() at the latest. on_frame is never called if this throws. When
+    // waiting for a frame fails, every frame still in flight is handed to
+    // its callback with null pixels before the failure is rethrown.
+    void render(const render_job &job, frame_callback on_frame);
+
+    // Submits the batches that are due and hands out the frames that have
+    // finished, without waiting for the others.
+    void poll();
+
+    // Waits for all frames in flight and hands out their pixels, and for the
+    // uploads of new meshes.
+    void flush();
+
+    // Uploads positions into the geometry heap without waiting for the copy,
+    // jobs rendered afterwards see the mesh. Meshes share one buffer and
+    // are told apart by dynamic offsets, so drawing many of them neither
+    // binds nor writes descriptor sets. The heap holds 16 MiB of positions
+    // in total. With bound descriptors every mesh is bound with the same
+    // 64 KiB range, which limits a mesh to 8192 vertices. Bindless, every
+    // mesh also takes an element of the mesh descriptor array, which holds
+    // up to 4096, fewer where the device's update-after-bind limits are
+    // lower. Throws when a limit is exceeded.
+    vkx::mesh create_mesh(const std::vector<glm::vec2> &positions);
+
+    // Returns the mesh's space to the heap. No job in flight may draw it,
+    // call flush() first.
+    void destroy_mesh(const vkx::mesh &mesh);
+
+    const vkx::memory_arena &get_memory_arena() const { return memory_arena; }
+
+    // Properties of the memory frames are read back from, empty before the
+    // first job.
+    vk::MemoryPropertyFlags get_readback_memory_flags() const;
+
+    // Total time spent recording command buffers.
+    double get_recording_seconds() const { return recording_seconds; }
+
+    // Number of draws recorded so far, one per mesh of every recorded job.
+    size_t get_recorded_draw_count() const { return recorded_draws; }
+
+    // How draws get their descriptors on this device.
+    descriptor_model get_descriptor_model() const
+    {
+        return active_descriptor_model;
+    }
+
+    // Number of vkQueueSubmit calls for jobs so far.
+    size_t get_submit_count() const;
+
+    // Number of descriptor sets written so far, which stops growing once
+    // every slot has cached the sets its jobs bind. Always zero when pushing
+    // descriptors.
+    size_t get_descriptor_update_count() const;
+
+  private:
+    const color_pipeline &get_color_pipeline(vk::Format format);
+    void                  queue_frame(frame_slot &slot);
+    void                  submit_pending();
+    void                  retire(frame_slot &slot);
+    void                  abandon_frames();
+
+    vkx::instance                        instance;
+    vkx::debug_report_callback_ext       debug_report_callback_ext;
+    vkx::physical_device                 physical_device;
+    vk::PhysicalDeviceLimits             limits;
+    vkx::device                          device;
+    vkx::memory_arena                    memory_arena;
+    vkx::staging_ring                    staging_ring;
+    vkx::command_pool                    command_pool;
+    vkx::command_pool                    transfer_command_pool;
+    std::vector<vkx::command_pool>       recording_command_pools;
+    vkx::queue_set                       queues;
+    vkx::pipeline_cache                  pipeline_cache;
+    vkx::descriptor_set_layout           descriptor_set_layout;
+    vkx::pipeline_layout                 pipeline_layout;
+    vkx::descriptor_push_template        descriptor_push;
+    vkx::storage_buffer_array            mesh_descriptors;
+    descriptor_model                     active_descriptor_model;
+    vkx::shader_module                   vertex_shader;
+    vkx::shader_module                   fragment_shader;
+    std::map<vk::Format, color_pipeline> color_pipelines;
+    vkx::geometry_heap                   geometry;
+    std::vector<vkx::mesh>               default_meshes;
+    vkx::bound_buffer                    parameters;
+    std::vector<frame_slot>              frame_slots;
+    size_t                               next_slot = 0;
+    vkx::worker_pool                     recording_workers;
+    double                               recording_seconds = 0;
+    size_t                               recorded_draws    = 0;
+    std::unique_ptr<vkx::submit_batch>   graphics_batch;
+    std::unique_ptr<vkx::submit_batch>   transfer_batch;
+    // the most recent mesh upload, destroyed first so that the heap is only
+    // released once every upload into it is done
+    vkx::completion_token                uploading;
+};
+}
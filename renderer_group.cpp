@@ -0,0 +1,82 @@
+#include "renderer_group.hpp"
+
+namespace vkx
+{
+renderer_group::renderer_group(size_t frames_in_flight, size_t shard_count,
+                               size_t                    recording_threads,
+                               size_t                    jobs_per_submit,
+                               std::chrono::microseconds max_submit_delay,
+                               descriptor_model          preferred_descriptors)
+{
+    if (shard_count == 0)
+        shard_count = count_physical_devices();
+
+    for (size_t i = 0; i < shard_count; ++i)
+    {
+        std::unique_ptr<shard> created(new shard);
+        created->renderer.reset(new vkx::renderer(
+            frames_in_flight, recording_threads, jobs_per_submit,
+            max_submit_delay, i, preferred_descriptors));
+        created->worker.reset(new vkx::render_worker(*created->renderer));
+        shards.push_back(std::move(created));
+    }
+}
+
+void renderer_group::enqueue(const render_job &job, frame_callback on_frame)
+{
+    auto &target = pick();
+    ++target.queued;
+
+    auto enqueued = std::chrono::steady_clock::now();
+    target.worker->enqueue(job, [&target, enqueued, on_frame](
+                                    const void *pixels, size_t size) {
+        // the time the shard spent on this job, from when it finished the
+        // previous one or got this one, whichever is later
+        auto now     = std::chrono::steady_clock::now();
+        auto seconds = std::chrono::duration<double>(
+                           now - std::max(enqueued, target.last_completion))
+                           .count();
+        target.last_completion = now;
+
+        auto average = target.seconds_per_job.load(std::memory_order_relaxed);
+        target.seconds_per_job.store(
+            average > 0 ? average * 0.9 + seconds * 0.1 : seconds,
+            std::memory_order_relaxed);
+
+        --target.queued;
+        ++target.completed;
+        if (on_frame)
+            on_frame(pixels, size);
+    });
+}
+
+void renderer_group::flush()
+{
+    for (auto &shard : shards)
+        shard->worker->flush();
+}
+
+// The expected time to finish one more job is the queue depth times the
+// time a job takes. Shards that have not finished a job yet count as
+// infinitely fast, so that every shard gets measured.
+renderer_group::shard &renderer_group::pick()
+{
+    shard *best          = nullptr;
+    double best_estimate = 0;
+    for (auto &candidate : shards)
+    {
+        auto estimate =
+            double(candidate->queued.load(std::memory_order_relaxed) + 1) *
+            candidate->seconds_per_job.load(std::memory_order_relaxed);
+        if (!best || estimate < best_estimate ||
+            (estimate == best_estimate &&
+             candidate->queued.load(std::memory_order_relaxed) <
+                 best->queued.load(std::memory_order_relaxed)))
+        {
+            best          = candidate.get();
+            best_estimate = estimate;
+        }
+    }
+    return *best;
+}
+}
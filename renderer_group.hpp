@@ -0,0 +1,66 @@
+#pragma once
+
+#include "render_worker.hpp"
+
+namespace vkx
+{
+// Spreads jobs over several renderers, each with its own device, queues,
+// pools and pipelines and fed by its own render worker. Every job goes to
+// the shard that is expected to finish it first, judging by the jobs queued
+// on it and how long its recent jobs took. Callbacks run on the worker
+// threads of the shards, so they can run concurrently.
+class renderer_group
+{
+  public:
+    // Creates shard_count renderers, spread over the suitable physical
+    // devices best first and wrapping around. Zero means one per device.
+    // Every shard is set up with the remaining arguments, see renderer.
+    explicit renderer_group(size_t frames_in_flight  = 3,
+                            size_t shard_count       = 0,
+                            size_t recording_threads = 1,
+                            size_t jobs_per_submit   = 1,
+                            std::chrono::microseconds max_submit_delay =
+                                std::chrono::milliseconds(2),
+                            descriptor_model preferred_descriptors =
+                                descriptor_model::bindless);
+
+    renderer_group(const renderer_group &) = delete;
+    renderer_group &operator=(const renderer_group &) = delete;
+
+    // Thread safe, waits for room on the chosen shard. Shards are rated by
+    // a moving average of the time their jobs take, which their worker
+    // threads update as the jobs complete.
+    void enqueue(const render_job &job, frame_callback on_frame);
+
+    // Waits until every job enqueued before the call has been handed out.
+    void flush();
+
+    size_t size() const { return shards.size(); }
+
+    size_t get_job_count(size_t shard) const
+    {
+        return shards[shard]->completed.load();
+    }
+
+    // Only safe to use while no jobs are queued on the shard.
+    const vkx::renderer &get_renderer(size_t shard) const
+    {
+        return *shards[shard]->renderer;
+    }
+
+  private:
+    struct shard
+    {
+        std::unique_ptr<vkx::renderer>        renderer;
+        std::unique_ptr<vkx::render_worker>   worker;
+        std::atomic<size_t>                   queued{0};
+        std::atomic<size_t>                   completed{0};
+        std::atomic<double>                   seconds_per_job{0};
+        std::chrono::steady_clock::time_point last_completion;
+    };
+
+    shard &pick();
+
+    std::vector<std::unique_ptr<shard>> shards;
+};
+}
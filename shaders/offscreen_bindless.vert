@@ -0,0 +1,29 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+out gl_PerVertex { vec4 gl_Position; };
+
+layout(location = 0) out vec4 fragColor;
+
+// every mesh of the renderer, draws pick theirs by index
+layout(set = 1, binding = 0) buffer MeshStorageBuffer
+{
+    vec2 positions[];
+}
+meshes[];
+
+layout(set = 0, binding = 0) uniform JobParameters { vec4 colors[16]; }
+jobParameters;
+
+layout(push_constant) uniform Draw { uint mesh; }
+draw;
+
+void main()
+{
+    vec4 offset = vec4(2 * cos(gl_InstanceIndex / 5.0f),
+                       2 * sin(gl_InstanceIndex / 5.0f), 0,
+                       gl_InstanceIndex / 100.0f + 1.0f);
+    gl_Position =
+        vec4(meshes[draw.mesh].positions[gl_VertexIndex], 0.6, 1.0) + offset;
+    fragColor = vec4(jobParameters.colors[gl_InstanceIndex % 16].rgb, 1);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "vkx.hpp"
+
+// A device with one graphics queue and a command pool, without any of the
+// renderer around it, for tests and for baselines that talk to Vulkan
+// directly.
+struct test_context
+{
+    vkx::instance      instance;
+    vk::PhysicalDevice physical_device;
+    vkx::device        device;
+    vk::Queue          queue;
+    vkx::command_pool  command_pool;
+
+    test_context()
+    {
+        instance = vkx::instance(vk::createInstance(vk::InstanceCreateInfo()));
+        physical_device = vkx::find_physical_devices(*instance).front();
+        auto family =
+            vkx::find_queue_families(physical_device).graphics_family;
+
+        static const float      queue_priorities[] = {1.0f};
+        vk::DeviceQueueCreateInfo device_queue_create_info;
+        device_queue_create_info.setQueueFamilyIndex(family)
+            .setQueueCount(1)
+            .setPQueuePriorities(queue_priorities);
+        vk::DeviceCreateInfo device_info;
+        device_info.setQueueCreateInfoCount(1).setPQueueCreateInfos(
+            &device_queue_create_info);
+        device = vkx::device(physical_device.createDevice(device_info));
+        queue  = device->getQueue(family, 0);
+
+        vk::CommandPoolCreateInfo command_pool_create_info;
+        command_pool_create_info.setQueueFamilyIndex(family);
+        command_pool = vkx::command_pool(
+            device->createCommandPool(command_pool_create_info),
+            vkx::device_child_deleter{*device});
+    }
+
+    vkx::command_buffer allocate_command_buffer() const
+    {
+        vk::CommandBufferAllocateInfo command_buffer_allocate_info;
+        command_buffer_allocate_info.setCommandPool(*command_pool)
+            .setLevel(vk::CommandBufferLevel::ePrimary)
+            .setCommandBufferCount(1);
+        return vkx::command_buffer(
+            device->allocateCommandBuffers(command_buffer_allocate_info)[0],
+            vkx::command_buffer_deleter{*device, *command_pool});
+    }
+
+    vkx::buffer create_buffer(vk::DeviceSize size) const
+    {
+        vk::BufferCreateInfo buffer_create_info;
+        buffer_create_info.setSharingMode(vk::SharingMode::eExclusive)
+            .setSize(size)
+            .setUsage(vk::BufferUsageFlagBits::eTransferSrc |
+                      vk::BufferUsageFlagBits::eTransferDst);
+        return vkx::buffer(device->createBuffer(buffer_create_info),
+                           vkx::device_child_deleter{*device});
+    }
+};
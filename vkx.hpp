@@ -0,0 +1,2458 @@
+#pragma once
+
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <bitset>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vulkan/vulkan.hpp>
+#ifndef VKX_EMBEDDED_SHADERS
+#include <shaderc/shaderc.hpp>
+#endif
+
+namespace vkx
+{
+// Owns a Vulkan object and destroys it through Deleter. Deleter is a small
+// value type that knows how to destroy T and holds the parent objects that
+// requires, so a handle never allocates and moving it is a couple of stores.
+// Parents are held as plain Vulkan handles and must outlive their children,
+// which owners ensure through declaration order.
+template <typename T, typename Deleter>
+class unique_handle
+{
+  public:
+    unique_handle() = default;
+
+    unique_handle(const T &value, Deleter deleter = Deleter())
+        : value(value), deleter(std::move(deleter))
+    {
+    }
+
+    unique_handle(unique_handle &&other) noexcept
+        : value(other.value), deleter(std::move(other.deleter))
+    {
+        other.value = T();
+    }
+
+    unique_handle &operator=(unique_handle &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            value       = other.value;
+            deleter     = std::move(other.deleter);
+            other.value = T();
+        }
+        return *this;
+    }
+
+    unique_handle(const unique_handle &) = delete;
+    unique_handle &operator=(const unique_handle &) = delete;
+
+    ~unique_handle() { reset(); }
+
+    void reset()
+    {
+        if (value)
+            deleter(value);
+        value = T();
+    }
+
+    const T &operator*() const { return value; }
+    const T *operator->() const { return &value; }
+    const T &get() const { return value; }
+
+    explicit operator bool() const { return bool(value); }
+
+  private:
+    T       value = T();
+    Deleter deleter;
+};
+
+struct instance_deleter
+{
+    void operator()(vk::Instance instance) const { instance.destroy(); }
+};
+
+struct device_deleter
+{
+    void operator()(vk::Device device) const { device.destroy(); }
+};
+
+struct debug_report_callback_deleter
+{
+    vk::Instance instance;
+
+    void operator()(vk::DebugReportCallbackEXT callback) const
+    {
+        auto vkDestroyDebugReportCallbackEXT =
+            (PFN_vkDestroyDebugReportCallbackEXT)instance.getProcAddr(
+                "vkDestroyDebugReportCallbackEXT");
+        vkDestroyDebugReportCallbackEXT(
+            instance, static_cast<VkDebugReportCallbackEXT>(callback),
+            nullptr);
+    }
+};
+
+// the loader does not export extension commands, so they are looked up
+struct descriptor_update_template_deleter
+{
+    vk::Device device;
+
+    void operator()(vk::DescriptorUpdateTemplateKHR update_template) const
+    {
+        auto vkDestroyDescriptorUpdateTemplateKHR =
+            (PFN_vkDestroyDescriptorUpdateTemplateKHR)device.getProcAddr(
+                "vkDestroyDescriptorUpdateTemplateKHR");
+        vkDestroyDescriptorUpdateTemplateKHR(
+            static_cast<VkDevice>(device),
+            static_cast<VkDescriptorUpdateTemplateKHR>(update_template),
+            nullptr);
+    }
+};
+
+// destroys every object that is created directly from a device
+struct device_child_deleter
+{
+    vk::Device device;
+
+    void operator()(vk::CommandPool pool) const
+    {
+        device.destroyCommandPool(pool);
+    }
+    void operator()(vk::ShaderModule shader) const
+    {
+        device.destroyShaderModule(shader);
+    }
+    void operator()(vk::DescriptorSetLayout layout) const
+    {
+        device.destroyDescriptorSetLayout(layout);
+    }
+    void operator()(vk::Buffer buffer) const { device.destroyBuffer(buffer); }
+    void operator()(vk::Image image) const { device.destroyImage(image); }
+    void operator()(vk::ImageView view) const
+    {
+        device.destroyImageView(view);
+    }
+    void operator()(vk::PipelineLayout layout) const
+    {
+        device.destroyPipelineLayout(layout);
+    }
+    void operator()(vk::Pipeline pipeline) const
+    {
+        device.destroyPipeline(pipeline);
+    }
+    void operator()(vk::RenderPass render_pass) const
+    {
+        device.destroyRenderPass(render_pass);
+    }
+    void operator()(vk::Framebuffer frame_buffer) const
+    {
+        device.destroyFramebuffer(frame_buffer);
+    }
+    void operator()(vk::DescriptorPool pool) const
+    {
+        device.destroyDescriptorPool(pool);
+    }
+    void operator()(vk::Semaphore semaphore) const
+    {
+        device.destroySemaphore(semaphore);
+    }
+};
+
+struct command_buffer_deleter
+{
+    vk::Device      device;
+    vk::CommandPool pool;
+
+    void operator()(vk::CommandBuffer command_buffer) const
+    {
+        device.freeCommandBuffers(pool, {command_buffer});
+    }
+};
+
+// physical devices and queues are not owned by the application
+using physical_device = vk::PhysicalDevice;
+using queue           = vk::Queue;
+
+using instance = unique_handle<vk::Instance, instance_deleter>;
+using debug_report_callback_ext =
+    unique_handle<vk::DebugReportCallbackEXT, debug_report_callback_deleter>;
+using device       = unique_handle<vk::Device, device_deleter>;
+using command_pool = unique_handle<vk::CommandPool, device_child_deleter>;
+using command_buffer =
+    unique_handle<vk::CommandBuffer, command_buffer_deleter>;
+using shader_module = unique_handle<vk::ShaderModule, device_child_deleter>;
+using descriptor_set_layout =
+    unique_handle<vk::DescriptorSetLayout, device_child_deleter>;
+using buffer     = unique_handle<vk::Buffer, device_child_deleter>;
+using image      = unique_handle<vk::Image, device_child_deleter>;
+using image_view = unique_handle<vk::ImageView, device_child_deleter>;
+using pipeline_layout =
+    unique_handle<vk::PipelineLayout, device_child_deleter>;
+using pipeline     = unique_handle<vk::Pipeline, device_child_deleter>;
+using render_pass  = unique_handle<vk::RenderPass, device_child_deleter>;
+using frame_buffer = unique_handle<vk::Framebuffer, device_child_deleter>;
+using descriptor_pool =
+    unique_handle<vk::DescriptorPool, device_child_deleter>;
+using semaphore = unique_handle<vk::Semaphore, device_child_deleter>;
+using descriptor_update_template =
+    unique_handle<vk::DescriptorUpdateTemplateKHR,
+                  descriptor_update_template_deleter>;
+
+inline VkBool32 VKAPI_PTR log(VkDebugReportFlagsEXT      flags,
+                              VkDebugReportObjectTypeEXT object_type,
+                              uint64_t object, size_t location,
+                              int32_t messageCode, const char *pLayerPrefix,
+                              const char *pMessage, void *pUserData)
+{
+    auto flags_       = static_cast<vk::DebugReportFlagBitsEXT>(flags);
+    auto object_type_ = static_cast<vk::DebugReportObjectTypeEXT>(object_type);
+
+    std::ostream &out =
+        flags == VK_DEBUG_REPORT_ERROR_BIT_EXT ? std::cerr : std::cout;
+    out << vk::to_string(flags_) << " : " << vk::to_string(object_type_)
+        << " : " << pLayerPrefix << " : " << pMessage
+        << /*" : object " << object
+        << " : location : " << location << " : messageCode : " << messageCode
+        <<*/ std::endl;
+    out.flush();
+    return flags_ == decltype(flags_)::eError ? VK_TRUE : VK_FALSE;
+}
+
+// Whether to report on std::cout which device, queues and descriptors were
+// picked, memory blocks as they are allocated and how the SPIR-V cache did.
+// Off unless VKX_VERBOSE is set, so that embedding renderers stays quiet.
+inline bool verbose()
+{
+    static const bool enabled = std::getenv("VKX_VERBOSE") != nullptr;
+    return enabled;
+}
+
+inline auto load_binary_file(const std::string &filename)
+{
+    std::ifstream ifs(filename.c_str(), std::ios::binary | std::ios::ate);
+    if (!ifs)
+        return std::vector<char>();
+    std::ifstream::pos_type pos = ifs.tellg();
+
+    std::vector<char> result(pos);
+
+    ifs.seekg(0, std::ios::beg);
+    ifs.read(result.data(), pos);
+
+    return result;
+};
+
+inline std::string load_text_file(const std::string &filename)
+{
+    auto data = load_binary_file(filename);
+    return std::string(data.begin(), data.end());
+}
+
+// What the memory of a resource is used for, which decides the memory type
+// it prefers.
+enum class memory_usage
+{
+    device,   // only accessed by the device
+    upload,   // written sequentially by the host, read by the device
+    readback, // written by the device, read by the host
+};
+
+inline const char *to_string(memory_usage usage)
+{
+    switch (usage)
+    {
+    case memory_usage::device:
+        return "device";
+    case memory_usage::upload:
+        return "upload";
+    case memory_usage::readback:
+        return "readback";
+    }
+    return "unknown";
+}
+
+// Picks the best memory type for usage among those allowed by resource_type.
+// Types missing a required property are skipped, the rest are ranked by the
+// properties that make the intended access fast. Ties go to the lower index,
+// which drivers order by performance.
+inline size_t
+find_memory_index(const vk::PhysicalDeviceMemoryProperties &mem_caps,
+                  const std::bitset<32> &                   resource_type,
+                  memory_usage                              usage)
+{
+    using bits = vk::MemoryPropertyFlagBits;
+
+    vk::MemoryPropertyFlags required;
+    if (usage == memory_usage::upload)
+        required = bits::eHostVisible | bits::eHostCoherent;
+    else if (usage == memory_usage::readback)
+        required = bits::eHostVisible;
+
+    auto score = [usage](vk::MemoryPropertyFlags flags) {
+        auto has = [flags](bits bit) { return bool(flags & bit); };
+        switch (usage)
+        {
+        case memory_usage::device:
+            return 2 * has(bits::eDeviceLocal) - has(bits::eHostVisible);
+        case memory_usage::upload:
+            // uncached write-combined memory is fastest to stream into
+            return -int(has(bits::eHostCached));
+        case memory_usage::readback:
+            // reading uncached memory is an order of magnitude slower
+            return 2 * has(bits::eHostCached) + has(bits::eHostCoherent);
+        }
+        return 0;
+    };
+
+    size_t best       = mem_caps.memoryTypeCount;
+    int    best_score = 0;
+    for (size_t i = 0; i < mem_caps.memoryTypeCount; ++i)
+    {
+        auto flags = mem_caps.memoryTypes[i].propertyFlags;
+        if (!resource_type[i] || (flags & required) != required)
+            continue;
+        if (best == mem_caps.memoryTypeCount || score(flags) > best_score)
+        {
+            best       = i;
+            best_score = score(flags);
+        }
+    }
+    if (best == mem_caps.memoryTypeCount)
+        throw std::runtime_error(
+            std::string("could not find an appropriate memory index for ") +
+            to_string(usage));
+    return best;
+}
+
+// Whether physical_device can run the renderer: it needs a graphics queue,
+// a depth format and every color format in color_formats as attachments.
+inline bool
+is_suitable_physical_device(vk::PhysicalDevice             physical_device,
+                            const std::vector<vk::Format> &color_formats)
+{
+    auto queue_families = physical_device.getQueueFamilyProperties();
+    if (std::none_of(queue_families.begin(), queue_families.end(),
+                     [](const vk::QueueFamilyProperties &props) {
+                         return bool(props.queueFlags &
+                                     vk::QueueFlagBits::eGraphics);
+                     }))
+        return false;
+
+    auto supports = [&](vk::Format format, vk::FormatFeatureFlagBits feature) {
+        return bool(physical_device.getFormatProperties(format)
+                        .optimalTilingFeatures &
+                    feature);
+    };
+    if (!supports(vk::Format::eD32Sfloat,
+                  vk::FormatFeatureFlagBits::eDepthStencilAttachment))
+        return false;
+    return std::all_of(color_formats.begin(), color_formats.end(),
+                       [&](vk::Format format) {
+                           return supports(
+                               format,
+                               vk::FormatFeatureFlagBits::eColorAttachment);
+                       });
+}
+
+inline bool has_extension(const std::vector<vk::ExtensionProperties> &available,
+                          const char *                                name)
+{
+    return std::any_of(available.begin(), available.end(),
+                       [name](const vk::ExtensionProperties &extension) {
+                           return std::strcmp(extension.extensionName,
+                                              name) == 0;
+                       });
+}
+
+// Whether physical_device can push descriptors through update templates.
+// VK_KHR_push_descriptor also needs VK_KHR_get_physical_device_properties2
+// enabled on the instance.
+inline bool supports_push_descriptors(vk::PhysicalDevice physical_device)
+{
+    auto available = physical_device.enumerateDeviceExtensionProperties();
+    return has_extension(available, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME) &&
+           has_extension(available,
+                         VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+}
+
+// Whether physical_device can index an array of storage buffers with a
+// dynamically uniform index, leave elements of the array unwritten and write
+// them while the array is bound. Needs VK_KHR_get_physical_device_properties2
+// enabled on instance.
+inline bool supports_descriptor_indexing(vk::Instance       instance,
+                                         vk::PhysicalDevice physical_device)
+{
+    auto available = physical_device.enumerateDeviceExtensionProperties();
+    if (!has_extension(available,
+                       VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) ||
+        !has_extension(available, VK_KHR_MAINTENANCE3_EXTENSION_NAME) ||
+        !physical_device.getFeatures().shaderStorageBufferArrayDynamicIndexing)
+        return false;
+
+    auto vkGetPhysicalDeviceFeatures2KHR =
+        (PFN_vkGetPhysicalDeviceFeatures2KHR)instance.getProcAddr(
+            "vkGetPhysicalDeviceFeatures2KHR");
+    if (!vkGetPhysicalDeviceFeatures2KHR)
+        return false;
+
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features;
+    vk::PhysicalDeviceFeatures2KHR                  features;
+    features.setPNext(&indexing_features);
+    vkGetPhysicalDeviceFeatures2KHR(
+        static_cast<VkPhysicalDevice>(physical_device),
+        reinterpret_cast<VkPhysicalDeviceFeatures2KHR *>(&features));
+    return indexing_features.runtimeDescriptorArray &&
+           indexing_features.descriptorBindingPartiallyBound &&
+           indexing_features.descriptorBindingStorageBufferUpdateAfterBind &&
+           indexing_features.descriptorBindingUpdateUnusedWhilePending;
+}
+
+// The most storage buffers a descriptor array that is updated after binding
+// may hold, per set and per stage, or zero when that can not be queried.
+// Needs VK_KHR_get_physical_device_properties2 enabled on instance.
+inline uint32_t
+max_update_after_bind_storage_buffers(vk::Instance       instance,
+                                      vk::PhysicalDevice physical_device)
+{
+    auto vkGetPhysicalDeviceProperties2KHR =
+        (PFN_vkGetPhysicalDeviceProperties2KHR)instance.getProcAddr(
+            "vkGetPhysicalDeviceProperties2KHR");
+    if (!vkGetPhysicalDeviceProperties2KHR)
+        return 0;
+
+    vk::PhysicalDeviceDescriptorIndexingPropertiesEXT indexing_properties;
+    vk::PhysicalDeviceProperties2KHR                  properties;
+    properties.setPNext(&indexing_properties);
+    vkGetPhysicalDeviceProperties2KHR(
+        static_cast<VkPhysicalDevice>(physical_device),
+        reinterpret_cast<VkPhysicalDeviceProperties2KHR *>(&properties));
+    return std::min(
+        indexing_properties.maxDescriptorSetUpdateAfterBindStorageBuffers,
+        indexing_properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers);
+}
+
+// Higher is better. The device type dominates (discrete, integrated, virtual,
+// CPU), then the size of the largest device-local heap, then whether a
+// transfer-only queue family is available for asynchronous copies.
+inline uint64_t score_physical_device(vk::PhysicalDevice physical_device)
+{
+    uint64_t type_rank = 0;
+    switch (physical_device.getProperties().deviceType)
+    {
+    case vk::PhysicalDeviceType::eDiscreteGpu:
+        type_rank = 4;
+        break;
+    case vk::PhysicalDeviceType::eIntegratedGpu:
+        type_rank = 3;
+        break;
+    case vk::PhysicalDeviceType::eVirtualGpu:
+        type_rank = 2;
+        break;
+    case vk::PhysicalDeviceType::eCpu:
+        type_rank = 1;
+        break;
+    default:
+        break;
+    }
+
+    vk::DeviceSize local_heap = 0;
+    auto           mem_caps   = physical_device.getMemoryProperties();
+    for (uint32_t i = 0; i < mem_caps.memoryHeapCount; ++i)
+        if (mem_caps.memoryHeaps[i].flags &
+            vk::MemoryHeapFlagBits::eDeviceLocal)
+            local_heap = std::max(local_heap, mem_caps.memoryHeaps[i].size);
+
+    auto queue_families = physical_device.getQueueFamilyProperties();
+    bool transfer_queue = std::any_of(
+        queue_families.begin(), queue_families.end(),
+        [](const vk::QueueFamilyProperties &props) {
+            return (props.queueFlags & vk::QueueFlagBits::eTransfer) &&
+                   !(props.queueFlags & (vk::QueueFlagBits::eGraphics |
+                                         vk::QueueFlagBits::eCompute));
+        });
+
+    auto local_heap_mib =
+        std::min<uint64_t>(local_heap >> 20, (uint64_t(1) << 54) - 1);
+    return type_rank << 56 | local_heap_mib << 1 | uint64_t(transfer_queue);
+}
+
+// Returns every physical device that can run the renderer, best first.
+// VKX_DEVICE restricts the choice to the device with that enumeration index
+// if it is a number, or else to the devices whose name contains it.
+inline std::vector<vk::PhysicalDevice> find_physical_devices(
+    vk::Instance                   instance,
+    const std::vector<vk::Format> &color_formats = {
+        vk::Format::eR32G32B32A32Sfloat})
+{
+    auto        devices  = instance.enumeratePhysicalDevices();
+    const char *filter   = std::getenv("VKX_DEVICE");
+    bool        filtered = filter && *filter;
+
+    // a number never matches names, "1" would match "RTX 3080" otherwise
+    bool by_index =
+        filtered && std::all_of(filter, filter + std::strlen(filter),
+                                [](char c) { return c >= '0' && c <= '9'; });
+    auto index = by_index ? std::strtoull(filter, nullptr, 10) : 0;
+
+    size_t matches = 0;
+    std::vector<std::pair<uint64_t, vk::PhysicalDevice>> candidates;
+    for (size_t i = 0; i < devices.size(); ++i)
+    {
+        std::string name = devices[i].getProperties().deviceName;
+        if (by_index ? i != index
+                     : filtered && name.find(filter) == std::string::npos)
+            continue;
+        ++matches;
+        if (is_suitable_physical_device(devices[i], color_formats))
+            candidates.emplace_back(score_physical_device(devices[i]),
+                                    devices[i]);
+    }
+
+    if (filtered && matches == 0)
+        throw std::runtime_error(
+            std::string(by_index ? "no physical device has index "
+                                 : "no physical device name contains ") +
+            filter + ", see VKX_DEVICE");
+    if (candidates.empty())
+        throw std::runtime_error(
+            filtered ? std::string("no suitable physical device matches "
+                                   "VKX_DEVICE=") +
+                           filter
+                     : std::string("no suitable physical device"));
+
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [](const auto &a, const auto &b) {
+                         return a.first > b.first;
+                     });
+
+    std::vector<vk::PhysicalDevice> result;
+    for (const auto &candidate : candidates)
+        result.push_back(candidate.second);
+    return result;
+}
+
+// The queues work is spread over. Uploads and readbacks go to the transfer
+// queue, which is the graphics queue itself when the device has no
+// transfer-only family.
+struct queue_set
+{
+    uint32_t  graphics_family;
+    uint32_t  transfer_family;
+    vk::Queue graphics;
+    vk::Queue transfer;
+
+    bool separate_transfer() const
+    {
+        return transfer_family != graphics_family;
+    }
+};
+
+// Picks the families of a queue_set. A transfer-only family is backed by
+// copy engines that run concurrently with rendering. The queues themselves
+// are retrieved once the device has been created.
+inline queue_set find_queue_families(vk::PhysicalDevice physical_device)
+{
+    auto queue_families = physical_device.getQueueFamilyProperties();
+    auto graphics_family =
+        std::find_if(queue_families.begin(), queue_families.end(),
+                     [](const vk::QueueFamilyProperties &props) {
+                         return bool(props.queueFlags &
+                                     vk::QueueFlagBits::eGraphics);
+                     });
+    if (graphics_family == queue_families.end())
+        throw std::runtime_error("could not find a graphics queue");
+
+    auto transfer_family = std::find_if(
+        queue_families.begin(), queue_families.end(),
+        [](const vk::QueueFamilyProperties &props) {
+            return (props.queueFlags & vk::QueueFlagBits::eTransfer) &&
+                   !(props.queueFlags & (vk::QueueFlagBits::eGraphics |
+                                         vk::QueueFlagBits::eCompute));
+        });
+    if (transfer_family == queue_families.end())
+        transfer_family = graphics_family;
+
+    queue_set queues;
+    queues.graphics_family = uint32_t(
+        std::distance(queue_families.begin(), graphics_family));
+    queues.transfer_family = uint32_t(
+        std::distance(queue_families.begin(), transfer_family));
+    return queues;
+}
+
+inline auto get_memory_requirements(vk::Device dev, vk::Buffer b)
+{
+    return dev.getBufferMemoryRequirements(b);
+}
+
+inline auto get_memory_requirements(vk::Device dev, vk::Image i)
+{
+    return dev.getImageMemoryRequirements(i);
+}
+
+inline bool is_linear(vk::Buffer) { return true; }
+
+// images are always created with optimal tiling
+inline bool is_linear(vk::Image) { return false; }
+
+// bytes per texel of the color formats that can be rendered and read back
+inline vk::DeviceSize format_size(vk::Format format)
+{
+    switch (format)
+    {
+    case vk::Format::eR8G8B8A8Unorm:
+    case vk::Format::eR8G8B8A8Srgb:
+    case vk::Format::eB8G8R8A8Unorm:
+    case vk::Format::eR32Sfloat:
+        return 4;
+    case vk::Format::eR16G16B16A16Sfloat:
+    case vk::Format::eR32G32Sfloat:
+        return 8;
+    case vk::Format::eR32G32B32A32Sfloat:
+        return 16;
+    default:
+        throw std::runtime_error("unsupported color format " +
+                                 vk::to_string(format));
+    }
+}
+
+struct memory_range
+{
+    vk::DeviceMemory        memory;
+    vk::DeviceSize          offset;
+    vk::DeviceSize          size;
+    vk::MemoryPropertyFlags flags;
+
+    // stays valid for the lifetime of the allocation, null unless the memory
+    // is host visible
+    void *mapped;
+
+    explicit operator bool() const { return bool(memory); }
+};
+
+// Sub-allocates resources from large vk::DeviceMemory blocks, one set of
+// blocks per memory type. When bufferImageGranularity is larger than one,
+// linear and optimal resources are kept in separate blocks so that they never
+// share a granularity page. Host-visible blocks are mapped once when they are
+// allocated and stay mapped until the arena is destroyed.
+class arena
+{
+  public:
+    arena(vk::Device dev, const vk::PhysicalDeviceMemoryProperties &mem_caps,
+          vk::DeviceSize buffer_image_granularity,
+          vk::DeviceSize non_coherent_atom_size,
+          vk::DeviceSize block_size = vk::DeviceSize(64) << 20)
+        : dev(dev), mem_caps(mem_caps),
+          buffer_image_granularity(buffer_image_granularity),
+          non_coherent_atom_size(non_coherent_atom_size),
+          block_size(block_size)
+    {
+    }
+
+    arena(const arena &) = delete;
+    arena &operator=(const arena &) = delete;
+
+    ~arena()
+    {
+        for (auto &b : blocks)
+            dev.freeMemory(b.memory);
+    }
+
+    vk::Device get_device() const { return dev; }
+
+    memory_range allocate(vk::MemoryRequirements requirements,
+                          memory_usage usage, bool linear)
+    {
+        auto memory_index = uint32_t(
+            find_memory_index(mem_caps, requirements.memoryTypeBits, usage));
+        auto flags     = mem_caps.memoryTypes[memory_index].propertyFlags;
+        bool segregate = buffer_image_granularity > 1;
+
+        // ranges of non-coherent memory are flushed and invalidated in whole
+        // atoms, which must not spill into a neighbouring allocation
+        if ((flags & vk::MemoryPropertyFlagBits::eHostVisible) &&
+            !(flags & vk::MemoryPropertyFlagBits::eHostCoherent))
+        {
+            auto atom = std::max(non_coherent_atom_size, vk::DeviceSize(1));
+            requirements.alignment = std::max(requirements.alignment, atom);
+            requirements.size = (requirements.size + atom - 1) / atom * atom;
+        }
+
+        ++sub_allocations;
+        for (auto &b : blocks)
+        {
+            if (b.memory_index != memory_index ||
+                (segregate && b.linear != linear))
+                continue;
+
+            vk::DeviceSize offset;
+            if (b.take(requirements.size, requirements.alignment, offset))
+                return b.range(offset, requirements.size, flags);
+        }
+
+        vk::MemoryAllocateInfo memory_allocate_info;
+        memory_allocate_info
+            .setAllocationSize(std::max(block_size, requirements.size))
+            .setMemoryTypeIndex(memory_index);
+
+        block b;
+        b.memory         = dev.allocateMemory(memory_allocate_info);
+        b.memory_index   = memory_index;
+        b.linear         = linear;
+        b.free_ranges[0] = memory_allocate_info.allocationSize;
+        b.mapped         = nullptr;
+        if (flags & vk::MemoryPropertyFlagBits::eHostVisible)
+            b.mapped = dev.mapMemory(b.memory, 0, VK_WHOLE_SIZE);
+        ++device_allocations;
+
+        if (verbose())
+            std::cout << "memory type " << memory_index << " ("
+                      << vk::to_string(flags) << ") for " << to_string(usage)
+                      << ", new block of "
+                      << (memory_allocate_info.allocationSize >> 20) << " MiB"
+                      << std::endl;
+
+        vk::DeviceSize offset;
+        b.take(requirements.size, requirements.alignment, offset);
+        blocks.push_back(std::move(b));
+        return blocks.back().range(offset, requirements.size, flags);
+    }
+
+    void free(const memory_range &range)
+    {
+        auto b = std::find_if(blocks.begin(), blocks.end(),
+                              [&](const block &candidate) {
+                                  return candidate.memory == range.memory;
+                              });
+        if (b != blocks.end())
+            b->give(range.offset, range.size);
+    }
+
+    size_t device_allocation_count() const { return device_allocations; }
+    size_t sub_allocation_count() const { return sub_allocations; }
+
+  private:
+    struct block
+    {
+        vk::DeviceMemory memory;
+        uint32_t         memory_index;
+        bool             linear;
+        void *           mapped;
+
+        // offset -> size of every free range, coalesced on release
+        std::map<vk::DeviceSize, vk::DeviceSize> free_ranges;
+
+        memory_range range(vk::DeviceSize offset, vk::DeviceSize size,
+                           vk::MemoryPropertyFlags flags) const
+        {
+            return {memory, offset, size, flags,
+                    mapped ? static_cast<char *>(mapped) + offset : nullptr};
+        }
+
+        bool take(vk::DeviceSize size, vk::DeviceSize alignment,
+                  vk::DeviceSize &offset)
+        {
+            alignment = std::max(alignment, vk::DeviceSize(1));
+            for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it)
+            {
+                auto begin   = it->first;
+                auto end     = it->first + it->second;
+                auto aligned = (begin + alignment - 1) / alignment * alignment;
+                if (aligned + size > end)
+                    continue;
+
+                free_ranges.erase(it);
+                if (aligned > begin)
+                    free_ranges[begin] = aligned - begin;
+                if (aligned + size < end)
+                    free_ranges[aligned + size] = end - aligned - size;
+                offset = aligned;
+                return true;
+            }
+            return false;
+        }
+
+        void give(vk::DeviceSize offset, vk::DeviceSize size)
+        {
+            auto it = free_ranges.emplace(offset, size).first;
+
+            auto next = std::next(it);
+            if (next != free_ranges.end() &&
+                it->first + it->second == next->first)
+            {
+                it->second += next->second;
+                free_ranges.erase(next);
+            }
+
+            if (it != free_ranges.begin())
+            {
+                auto prev = std::prev(it);
+                if (prev->first + prev->second == it->first)
+                {
+                    prev->second += it->second;
+                    free_ranges.erase(it);
+                }
+            }
+        }
+    };
+
+    vk::Device                         dev;
+    vk::PhysicalDeviceMemoryProperties mem_caps;
+    vk::DeviceSize                     buffer_image_granularity;
+    vk::DeviceSize                     non_coherent_atom_size;
+    vk::DeviceSize                     block_size;
+    std::vector<block>                 blocks;
+    size_t                             device_allocations = 0;
+    size_t                             sub_allocations    = 0;
+};
+
+// owned by whoever created it, allocations and users only borrow it
+using memory_arena = std::unique_ptr<arena>;
+
+inline memory_arena create_memory_arena(vk::Device          dev,
+                                        vk::PhysicalDevice physical_device)
+{
+    auto limits = physical_device.getProperties().limits;
+    return memory_arena(new arena(dev, physical_device.getMemoryProperties(),
+                                  limits.bufferImageGranularity,
+                                  limits.nonCoherentAtomSize));
+}
+
+// returns a sub-allocation to the arena it came from, which must outlive it
+struct allocation_deleter
+{
+    arena *owner;
+
+    void operator()(const memory_range &range) const { owner->free(range); }
+};
+
+using allocation = unique_handle<memory_range, allocation_deleter>;
+
+template <typename Resource>
+allocation allocate(const memory_arena &a, Resource resource,
+                    memory_usage usage = memory_usage::device)
+{
+    auto memory_requirements =
+        get_memory_requirements(a->get_device(), resource);
+
+    return allocation(
+        a->allocate(memory_requirements, usage, is_linear(resource)),
+        allocation_deleter{a.get()});
+}
+
+inline void bind(vk::Device dev, vk::Buffer b, const allocation &a)
+{
+    dev.bindBufferMemory(b, a->memory, a->offset);
+}
+
+inline void bind(vk::Device dev, vk::Image i, const allocation &a)
+{
+    dev.bindImageMemory(i, a->memory, a->offset);
+}
+
+// Makes host writes through the mapping of an allocation visible to the
+// device. Coherent memory needs no flush.
+inline void flush(vk::Device dev, const allocation &a)
+{
+    if (a->flags & vk::MemoryPropertyFlagBits::eHostCoherent)
+        return;
+    dev.flushMappedMemoryRanges(
+        {vk::MappedMemoryRange(a->memory, a->offset, a->size)});
+}
+
+// Makes device writes to a host-visible allocation visible to the host
+// before it is read through a mapping. Coherent memory needs no invalidation.
+inline void invalidate(vk::Device dev, const allocation &a)
+{
+    if (a->flags & vk::MemoryPropertyFlagBits::eHostCoherent)
+        return;
+    dev.invalidateMappedMemoryRanges(
+        {vk::MappedMemoryRange(a->memory, a->offset, a->size)});
+}
+
+inline void begin(vk::CommandBuffer cb, bool single_time = false)
+{
+    vk::CommandBufferBeginInfo command_buffer_begin_info;
+    if (single_time)
+        command_buffer_begin_info.setFlags(
+            vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    cb.begin(command_buffer_begin_info);
+}
+
+inline void end(vk::CommandBuffer cb) { cb.end(); }
+
+// Tracks the completion of one queue submission through a fence owned by the
+// token. Continuations run on the thread that first observes completion
+// through ready() or wait(), so whoever wants them to fire polls.
+class completion
+{
+  public:
+    explicit completion(vk::Device dev)
+        : dev(dev), fence(dev.createFence(vk::FenceCreateInfo()))
+    {
+    }
+
+    completion(const completion &) = delete;
+    completion &operator=(const completion &) = delete;
+
+    ~completion()
+    {
+        // the fence must not be destroyed while the submission is pending,
+        // a fence that never was submitted has nothing to wait for. A lost
+        // device has nothing pending either.
+        try
+        {
+            if (submitted && !done)
+                dev.waitForFences({fence}, VK_TRUE,
+                                  std::numeric_limits<uint64_t>::max());
+        }
+        catch (const std::exception &)
+        {
+        }
+        dev.destroyFence(fence);
+    }
+
+    vk::Fence get_fence() const { return fence; }
+
+    // Submits submit_infos to q with the fence of the token. A token is
+    // submitted at most once.
+    void submit(vk::Queue                             q,
+                vk::ArrayProxy<const vk::SubmitInfo> submit_infos)
+    {
+        if (submitted)
+            throw std::runtime_error("completion token submitted twice");
+        q.submit(submit_infos, fence);
+        submitted = true;
+    }
+
+    bool ready()
+    {
+        if (!submitted)
+            return false;
+        if (!is_done() && dev.getFenceStatus(fence) == vk::Result::eSuccess)
+            complete();
+        return is_done();
+    }
+
+    void wait()
+    {
+        if (is_done())
+            return;
+        if (!submitted)
+            throw std::runtime_error(
+                "waiting for work that was never submitted");
+        dev.waitForFences({fence}, VK_TRUE,
+                          std::numeric_limits<uint64_t>::max());
+        complete();
+    }
+
+    void then(std::function<void()> continuation)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!done)
+            {
+                continuations.push_back(std::move(continuation));
+                return;
+            }
+        }
+        continuation();
+    }
+
+  private:
+    bool is_done()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return done;
+    }
+
+    // runs the continuations exactly once, outside the lock so that they may
+    // add continuations or tokens of their own
+    void complete()
+    {
+        std::vector<std::function<void()>> ready_continuations;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (done)
+                return;
+            done = true;
+            ready_continuations.swap(continuations);
+        }
+        for (auto &continuation : ready_continuations)
+            continuation();
+    }
+
+    vk::Device                         dev;
+    vk::Fence                          fence;
+    std::atomic<bool>                  submitted{false};
+    std::mutex                         mutex;
+    bool                               done = false;
+    std::vector<std::function<void()>> continuations;
+};
+
+// Shared because a submission has several owners that each release it on
+// their own schedule: the submit_batch until it is submitted, the frame slot
+// until it is retired, the staging ring until the upload's space and command
+// buffers are recycled, and whoever waits for the results. A token is made
+// once per submission, which the jobs of a batch share.
+using completion_token = std::shared_ptr<completion>;
+
+inline completion_token submit(vk::Device dev, vk::Queue q,
+                               vk::CommandBuffer cb)
+{
+    auto token = std::make_shared<completion>(dev);
+
+    vk::SubmitInfo submit_info;
+    submit_info.setCommandBufferCount(1).setPCommandBuffers(&cb);
+    token->submit(q, submit_info);
+    return token;
+}
+
+// Submits cb without a fence and signals semaphore once it completes, for
+// work whose completion is observed through a later submission.
+inline void submit(vk::Queue q, vk::CommandBuffer cb, vk::Semaphore signal)
+{
+    vk::SubmitInfo submit_info;
+    submit_info.setCommandBufferCount(1)
+        .setPCommandBuffers(&cb)
+        .setSignalSemaphoreCount(1)
+        .setPSignalSemaphores(&signal);
+    q.submit({submit_info}, vk::Fence());
+}
+
+// Submits cb to run once wait has been signaled. Only wait_stage and later
+// stages of cb are held back.
+inline completion_token submit(vk::Device dev, vk::Queue q,
+                               vk::CommandBuffer cb, vk::Semaphore wait,
+                               vk::PipelineStageFlags wait_stage)
+{
+    auto token = std::make_shared<completion>(dev);
+
+    vk::SubmitInfo submit_info;
+    submit_info.setCommandBufferCount(1)
+        .setPCommandBuffers(&cb)
+        .setWaitSemaphoreCount(1)
+        .setPWaitSemaphores(&wait)
+        .setPWaitDstStageMask(&wait_stage);
+    token->submit(q, submit_info);
+    return token;
+}
+
+inline semaphore create_semaphore(vk::Device dev)
+{
+    return semaphore(dev.createSemaphore(vk::SemaphoreCreateInfo()),
+                     device_child_deleter{dev});
+}
+
+// Collects command buffers for one queue and submits them together, one
+// SubmitInfo each, in a single vkQueueSubmit. Everything added until the
+// next submit() shares one completion token. The owner decides when to
+// submit, typically once due() says a size or time threshold was reached,
+// because batches on different queues that are linked by semaphores have to
+// be submitted signaling side first.
+class submit_batch
+{
+  public:
+    submit_batch(vk::Device dev, vk::Queue q, size_t max_submits,
+                 std::chrono::microseconds max_delay)
+        : dev(dev), q(q), max_submits(std::max<size_t>(max_submits, 1)),
+          max_delay(max_delay)
+    {
+        entries.reserve(this->max_submits);
+        submit_infos.reserve(this->max_submits);
+    }
+
+    submit_batch(const submit_batch &) = delete;
+    submit_batch &operator=(const submit_batch &) = delete;
+
+    // completion tokens of a batch never submitted would never complete
+    ~submit_batch() { submit(); }
+
+    // Queues cb, optionally waiting for and signaling a semaphore, and
+    // returns the token of the batch it will be submitted with.
+    const completion_token &
+    add(vk::CommandBuffer cb, vk::Semaphore wait = vk::Semaphore(),
+        vk::PipelineStageFlags wait_stage = vk::PipelineStageFlags(),
+        vk::Semaphore signal = vk::Semaphore())
+    {
+        if (!pending)
+        {
+            pending     = std::make_shared<completion>(dev);
+            first_added = std::chrono::steady_clock::now();
+        }
+        entries.push_back({cb, wait, wait_stage, signal});
+        return pending;
+    }
+
+    bool due() const
+    {
+        return !entries.empty() &&
+               (entries.size() >= max_submits ||
+                std::chrono::steady_clock::now() - first_added >= max_delay);
+    }
+
+    // Whether token belongs to work that has not been submitted yet, which
+    // must be submitted before waiting for it.
+    bool holds(const completion_token &token) const
+    {
+        return token && token == pending;
+    }
+
+    void submit()
+    {
+        if (entries.empty())
+            return;
+
+        for (const auto &entry : entries)
+        {
+            vk::SubmitInfo submit_info;
+            submit_info.setCommandBufferCount(1).setPCommandBuffers(
+                &entry.command_buffer);
+            if (entry.wait)
+                submit_info.setWaitSemaphoreCount(1)
+                    .setPWaitSemaphores(&entry.wait)
+                    .setPWaitDstStageMask(&entry.wait_stage);
+            if (entry.signal)
+                submit_info.setSignalSemaphoreCount(1).setPSignalSemaphores(
+                    &entry.signal);
+            submit_infos.push_back(submit_info);
+        }
+        pending->submit(q, submit_infos);
+
+        entries.clear();
+        submit_infos.clear();
+        pending.reset();
+        ++submit_counter;
+    }
+
+    size_t submit_count() const { return submit_counter; }
+
+  private:
+    struct entry
+    {
+        vk::CommandBuffer      command_buffer;
+        vk::Semaphore          wait;
+        vk::PipelineStageFlags wait_stage;
+        vk::Semaphore          signal;
+    };
+
+    vk::Device                            dev;
+    vk::Queue                             q;
+    size_t                                max_submits;
+    std::chrono::microseconds             max_delay;
+    std::vector<entry>                    entries;
+    std::vector<vk::SubmitInfo>           submit_infos;
+    completion_token                      pending;
+    std::chrono::steady_clock::time_point first_added;
+    size_t                                submit_counter = 0;
+};
+
+inline completion_token copy(vk::Device dev, vk::Queue q, vk::CommandBuffer cb,
+                             vk::Buffer from, vk::DeviceSize from_offset,
+                             vk::Buffer to, size_t size)
+{
+    begin(cb, true);
+
+    vk::BufferCopy buffer_copy;
+    buffer_copy.setDstOffset(0).setSize(size).setSrcOffset(from_offset);
+    cb.copyBuffer(from, to, {buffer_copy});
+
+    end(cb);
+    return submit(dev, q, cb);
+}
+
+inline void copy(vk::Device dev, const allocation &mem, const void *data,
+                 size_t size)
+{
+    if (!mem->mapped)
+        throw std::runtime_error("copy to memory that is not host visible");
+    std::memcpy(mem->mapped, data, size);
+    flush(dev, mem);
+}
+
+// Persistently mapped host-coherent buffer that serves all uploads. Space is
+// handed out in submission order and reclaimed once the fence of the transfer
+// that consumed it has signaled. Owns a dedicated allocation so that it can
+// stay mapped for its whole lifetime. The command buffers and semaphores
+// uploads are recorded with are recycled the same way.
+class ring
+{
+  public:
+    // What one upload records and submits, see upload.
+    struct upload_commands
+    {
+        command_buffer transfer;
+        command_buffer graphics;
+        semaphore      uploaded;
+    };
+
+    ring(vk::Device dev, const vk::PhysicalDeviceMemoryProperties &mem_caps,
+         const queue_set &queues,
+         vk::DeviceSize   capacity = vk::DeviceSize(16) << 20)
+        : dev(dev), capacity(capacity),
+          separate_transfer(queues.separate_transfer())
+    {
+        vk::CommandPoolCreateInfo command_pool_create_info;
+        command_pool_create_info.setQueueFamilyIndex(queues.transfer_family)
+            .setFlags(vk::CommandPoolCreateFlagBits::eTransient |
+                      vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+        transfer_pool =
+            command_pool(dev.createCommandPool(command_pool_create_info),
+                         device_child_deleter{dev});
+        if (separate_transfer)
+        {
+            command_pool_create_info.setQueueFamilyIndex(
+                queues.graphics_family);
+            graphics_pool =
+                command_pool(dev.createCommandPool(command_pool_create_info),
+                             device_child_deleter{dev});
+        }
+
+        vk::BufferCreateInfo buffer_create_info;
+        buffer_create_info.setSharingMode(vk::SharingMode::eExclusive)
+            .setSize(capacity)
+            .setUsage(vk::BufferUsageFlagBits::eTransferSrc);
+        staging_buffer = dev.createBuffer(buffer_create_info);
+
+        auto memory_requirements =
+            dev.getBufferMemoryRequirements(staging_buffer);
+        vk::MemoryAllocateInfo memory_allocate_info;
+        memory_allocate_info.setAllocationSize(memory_requirements.size)
+            .setMemoryTypeIndex(uint32_t(
+                find_memory_index(mem_caps, memory_requirements.memoryTypeBits,
+                                  memory_usage::upload)));
+        memory = dev.allocateMemory(memory_allocate_info);
+        dev.bindBufferMemory(staging_buffer, memory, 0);
+
+        mapped = static_cast<char *>(dev.mapMemory(memory, 0, capacity));
+    }
+
+    ring(const ring &) = delete;
+    ring &operator=(const ring &) = delete;
+
+    ~ring()
+    {
+        for (auto &region : in_flight)
+            region.token->wait();
+
+        dev.unmapMemory(memory);
+        dev.destroyBuffer(staging_buffer);
+        dev.freeMemory(memory);
+    }
+
+    vk::Buffer get_buffer() const { return staging_buffer; }
+
+    // Copies data into the ring and returns its offset in get_buffer(). The
+    // space stays reserved until the submission passed to the next commit()
+    // completes.
+    vk::DeviceSize write(const void *data, vk::DeviceSize size,
+                         vk::DeviceSize alignment = 16)
+    {
+        vk::DeviceSize offset;
+        while (!reserve(size, alignment, offset))
+        {
+            if (in_flight.empty())
+                throw std::runtime_error("upload does not fit in the staging "
+                                         "ring");
+            reclaim(true);
+        }
+
+        std::memcpy(mapped + offset, data, size);
+        pending = true;
+        return offset;
+    }
+
+    // Command buffers to record the next upload into, either idle ones of a
+    // finished upload or new ones. The graphics command buffer and the
+    // semaphore only exist with a separate transfer family.
+    upload_commands acquire_commands()
+    {
+        reclaim(false);
+        if (!idle_commands.empty())
+        {
+            auto commands = std::move(idle_commands.back());
+            idle_commands.pop_back();
+            return commands;
+        }
+
+        upload_commands commands;
+        commands.transfer = allocate_command_buffer(*transfer_pool);
+        if (separate_transfer)
+        {
+            commands.graphics = allocate_command_buffer(*graphics_pool);
+            commands.uploaded = create_semaphore(dev);
+        }
+        return commands;
+    }
+
+    // Ties everything written since the previous commit() to the submission
+    // that consumes it, and commands to it, which are idle again once it
+    // completes.
+    void commit(const completion_token &token, upload_commands commands)
+    {
+        in_flight.push_back({head, token, std::move(commands)});
+        pending = false;
+    }
+
+  private:
+    struct region
+    {
+        vk::DeviceSize   end;
+        completion_token token;
+        upload_commands  commands;
+    };
+
+    command_buffer allocate_command_buffer(vk::CommandPool pool) const
+    {
+        vk::CommandBufferAllocateInfo command_buffer_allocate_info;
+        command_buffer_allocate_info.setCommandPool(pool)
+            .setLevel(vk::CommandBufferLevel::ePrimary)
+            .setCommandBufferCount(1);
+        return command_buffer(
+            dev.allocateCommandBuffers(command_buffer_allocate_info)[0],
+            command_buffer_deleter{dev, pool});
+    }
+
+    void reclaim(bool wait)
+    {
+        while (!in_flight.empty())
+        {
+            auto &oldest = in_flight.front();
+            if (wait)
+                oldest.token->wait();
+            else if (!oldest.token->ready())
+                break;
+
+            tail = oldest.end;
+            idle_commands.push_back(std::move(oldest.commands));
+            in_flight.pop_front();
+            wait = false;
+        }
+
+        if (in_flight.empty() && !pending)
+            head = tail = 0;
+    }
+
+    // head == tail only ever means that the ring is empty
+    bool reserve(vk::DeviceSize size, vk::DeviceSize alignment,
+                 vk::DeviceSize &offset)
+    {
+        reclaim(false);
+
+        auto aligned = (head + alignment - 1) / alignment * alignment;
+        if (head >= tail)
+        {
+            if (aligned + size <= capacity)
+            {
+                offset = aligned;
+                head   = aligned + size;
+                return true;
+            }
+            if (size < tail)
+            {
+                offset = 0;
+                head   = size;
+                return true;
+            }
+            return false;
+        }
+
+        if (aligned + size < tail)
+        {
+            offset = aligned;
+            head   = aligned + size;
+            return true;
+        }
+        return false;
+    }
+
+    vk::Device                   dev;
+    vk::DeviceSize               capacity;
+    bool                         separate_transfer;
+    vk::Buffer                   staging_buffer;
+    vk::DeviceMemory             memory;
+    char *                       mapped;
+    vk::DeviceSize               head    = 0;
+    vk::DeviceSize               tail    = 0;
+    bool                         pending = false;
+    command_pool                 transfer_pool;
+    command_pool                 graphics_pool;
+    std::vector<upload_commands> idle_commands;
+    std::deque<region>           in_flight;
+};
+
+// owned by whoever created it, uploads only borrow it
+using staging_ring = std::unique_ptr<ring>;
+
+inline staging_ring
+create_staging_ring(vk::Device                                dev,
+                    const vk::PhysicalDeviceMemoryProperties &mem_caps,
+                    const queue_set &                         queues)
+{
+    return staging_ring(new ring(dev, mem_caps, queues));
+}
+
+// A buffer together with the memory bound to it. The buffer is declared last
+// so that it is destroyed before its memory is released.
+struct bound_buffer
+{
+    vkx::allocation memory;
+    vkx::buffer     buffer;
+};
+
+// Copies data into [offset, offset + size) of a device-local buffer through
+// the staging ring without waiting for the copy. The copy runs on the
+// transfer queue. With a separate transfer family, the range is then released
+// to the graphics family and acquired on the graphics queue behind a
+// semaphore. The range is overwritten, so it is acquired by the transfer
+// family without a release, while the rest of the buffer may stay in use.
+// Either way, work submitted to the graphics queue afterwards sees the data.
+// The returned token completes once the upload did, dst must stay alive
+// until then.
+inline completion_token upload(vk::Device dev, const staging_ring &staging,
+                               const queue_set &queues, vk::Buffer dst,
+                               vk::DeviceSize offset, const void *data,
+                               size_t size)
+{
+    auto staging_offset = staging->write(data, size);
+    auto commands       = staging->acquire_commands();
+    auto transfer_cb    = *commands.transfer;
+
+    vk::BufferMemoryBarrier uploaded_range;
+    uploaded_range.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setBuffer(dst)
+        .setOffset(offset)
+        .setSize(size)
+        .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+        .setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+
+    begin(transfer_cb, true);
+    vk::BufferCopy buffer_copy;
+    buffer_copy.setDstOffset(offset).setSize(size).setSrcOffset(
+        staging_offset);
+    transfer_cb.copyBuffer(staging->get_buffer(), dst, {buffer_copy});
+    if (!queues.separate_transfer())
+    {
+        // later submissions to the same queue read what was copied
+        transfer_cb.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                    vk::PipelineStageFlagBits::eAllCommands,
+                                    {}, {}, {uploaded_range}, {});
+        end(transfer_cb);
+
+        auto token = submit(dev, queues.transfer, transfer_cb);
+        staging->commit(token, std::move(commands));
+        return token;
+    }
+
+    // release
+    uploaded_range.setSrcQueueFamilyIndex(queues.transfer_family)
+        .setDstQueueFamilyIndex(queues.graphics_family)
+        .setDstAccessMask(vk::AccessFlags());
+    transfer_cb.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                vk::PipelineStageFlagBits::eBottomOfPipe, {},
+                                {}, {uploaded_range}, {});
+    end(transfer_cb);
+
+    auto graphics_cb = *commands.graphics;
+    begin(graphics_cb, true);
+    // acquire
+    uploaded_range.setSrcAccessMask(vk::AccessFlags())
+        .setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+    graphics_cb.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                vk::PipelineStageFlagBits::eAllCommands, {},
+                                {}, {uploaded_range}, {});
+    end(graphics_cb);
+
+    submit(queues.transfer, transfer_cb, *commands.uploaded);
+    auto token = submit(dev, queues.graphics, graphics_cb, *commands.uploaded,
+                        vk::PipelineStageFlagBits::eAllCommands);
+
+    // the graphics submission waits for the copy, so its fence also covers
+    // the staging space and both command buffers
+    staging->commit(token, std::move(commands));
+    return token;
+}
+
+// Uploads data into a new device-local buffer, see upload. The buffer must
+// not be destroyed before uploaded completes.
+inline bound_buffer create_buffer(const memory_arena &arena,
+                                  const staging_ring &staging,
+                                  const queue_set &   queues,
+                                  vk::BufferUsageFlags flags, const void *data,
+                                  size_t size, completion_token &uploaded)
+{
+    auto dev = arena->get_device();
+
+    vk::BufferCreateInfo buffer_create_info;
+    buffer_create_info.setSharingMode(vk::SharingMode::eExclusive)
+        .setSize(size)
+        .setUsage(flags | vk::BufferUsageFlagBits::eTransferDst);
+
+    bound_buffer result;
+    result.buffer =
+        buffer(dev.createBuffer(buffer_create_info), device_child_deleter{dev});
+    result.memory = allocate(arena, *result.buffer);
+    bind(dev, *result.buffer, result.memory);
+
+    uploaded = upload(dev, staging, queues, *result.buffer, 0, data, size);
+    return result;
+}
+
+template <typename T>
+bound_buffer create_buffer(const memory_arena &arena,
+                           const staging_ring &staging,
+                           const queue_set &   queues,
+                           vk::BufferUsageFlags flags, const T &data,
+                           completion_token &uploaded)
+{
+    return create_buffer(arena, staging, queues, flags, &data, sizeof(data),
+                         uploaded);
+}
+
+// One device-local storage buffer that many small ranges, such as meshes,
+// are sub-allocated from, so that they can share a descriptor set and be
+// told apart by dynamic offsets alone. Every range is bound with the same
+// descriptor range, max_range, so the buffer is padded by that much to keep
+// the binding of the last range in bounds. A max_range of zero is for users
+// that bind every range with its own size, it neither caps nor pads ranges.
+// Ranges are handed out first fit from a list of free ranges, which
+// neighbours are merged back into.
+class geometry_heap
+{
+  public:
+    geometry_heap() = default;
+
+    geometry_heap(const memory_arena &arena, vk::DeviceSize capacity,
+                  vk::DeviceSize max_range, vk::DeviceSize alignment)
+        : capacity(capacity), max_range(max_range), alignment(alignment)
+    {
+        auto dev = arena->get_device();
+
+        vk::BufferCreateInfo buffer_create_info;
+        buffer_create_info.setSharingMode(vk::SharingMode::eExclusive)
+            .setSize(capacity + max_range)
+            .setUsage(vk::BufferUsageFlagBits::eStorageBuffer |
+                      vk::BufferUsageFlagBits::eTransferDst);
+        storage.buffer = buffer(dev.createBuffer(buffer_create_info),
+                                device_child_deleter{dev});
+        // qualified, the member of the same name hides it
+        storage.memory = vkx::allocate(arena, *storage.buffer);
+        vkx::bind(dev, *storage.buffer, storage.memory);
+
+        free_ranges[0] = capacity;
+    }
+
+    vk::Buffer     get_buffer() const { return *storage.buffer; }
+    vk::DeviceSize get_max_range() const { return max_range; }
+
+    // Returns the offset of size free bytes, aligned for use as a dynamic
+    // offset.
+    vk::DeviceSize allocate(vk::DeviceSize size)
+    {
+        if (size == 0 || (max_range && size > max_range))
+            throw std::runtime_error("geometry of " + std::to_string(size) +
+                                     " bytes does not fit the heap's "
+                                     "binding range");
+        size = (size + alignment - 1) / alignment * alignment;
+
+        for (auto range = free_ranges.begin(); range != free_ranges.end();
+             ++range)
+        {
+            if (range->second < size)
+                continue;
+            auto offset = range->first;
+            if (range->second > size)
+                free_ranges[offset + size] = range->second - size;
+            free_ranges.erase(range);
+            return offset;
+        }
+        throw std::runtime_error("geometry heap is full");
+    }
+
+    // The range must not be used by pending work anymore.
+    void free(vk::DeviceSize offset, vk::DeviceSize size)
+    {
+        size = (size + alignment - 1) / alignment * alignment;
+
+        auto next = free_ranges.lower_bound(offset);
+        if (next != free_ranges.end() && offset + size == next->first)
+        {
+            size += next->second;
+            next = free_ranges.erase(next);
+        }
+        if (next != free_ranges.begin())
+        {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset)
+            {
+                previous->second += size;
+                return;
+            }
+        }
+        free_ranges[offset] = size;
+    }
+
+  private:
+    bound_buffer                             storage;
+    vk::DeviceSize                           capacity  = 0;
+    vk::DeviceSize                           max_range = 0;
+    vk::DeviceSize                           alignment = 1;
+    std::map<vk::DeviceSize, vk::DeviceSize> free_ranges;
+};
+
+// Descriptor sets of one layout whose bindings are all buffers, looked up by
+// the buffer ranges they bind so that binding the same ranges again neither
+// allocates nor updates a set. Sets come from a pool of the cache's own that
+// is reset as a whole once it runs out rather than freeing sets one by one.
+// Resetting invalidates every set handed out before, so get() must only be
+// called while none of them are used by pending work, e.g. for an idle frame.
+class descriptor_set_cache
+{
+  public:
+    descriptor_set_cache() = default;
+
+    descriptor_set_cache(vk::Device dev, vk::DescriptorSetLayout layout,
+                         std::vector<vk::DescriptorType> binding_types,
+                         uint32_t                        max_sets = 8)
+        : dev(dev), layout(layout), binding_types(std::move(binding_types)),
+          max_sets(max_sets)
+    {
+        std::vector<vk::DescriptorPoolSize> pool_sizes;
+        for (auto type : this->binding_types)
+        {
+            vk::DescriptorPoolSize pool_size;
+            pool_size.setType(type).setDescriptorCount(max_sets);
+            pool_sizes.push_back(pool_size);
+        }
+
+        vk::DescriptorPoolCreateInfo descriptor_pool_create_info;
+        descriptor_pool_create_info.setMaxSets(max_sets)
+            .setPoolSizeCount(uint32_t(pool_sizes.size()))
+            .setPPoolSizes(pool_sizes.data());
+        pool = descriptor_pool(
+            dev.createDescriptorPool(descriptor_pool_create_info),
+            device_child_deleter{dev});
+
+        entries.reserve(max_sets);
+    }
+
+    // Returns a set with buffers[i] bound to binding i.
+    vk::DescriptorSet
+    get(vk::ArrayProxy<const vk::DescriptorBufferInfo> buffers)
+    {
+        if (buffers.size() != binding_types.size())
+            throw std::runtime_error("expected a buffer for every binding");
+
+        auto key   = hash(buffers);
+        auto found = index.find(key);
+        if (found != index.end() && matches(entries[found->second], buffers))
+            return entries[found->second].set;
+
+        if (entries.size() == max_sets)
+        {
+            dev.resetDescriptorPool(*pool);
+            entries.clear();
+            index.clear();
+            ++reset_counter;
+        }
+
+        vk::DescriptorSetAllocateInfo descriptor_set_allocate_info;
+        descriptor_set_allocate_info.setDescriptorPool(*pool)
+            .setDescriptorSetCount(1)
+            .setPSetLayouts(&layout);
+        entry created;
+        created.set =
+            dev.allocateDescriptorSets(descriptor_set_allocate_info)[0];
+        created.buffers.assign(buffers.begin(), buffers.end());
+
+        std::vector<vk::WriteDescriptorSet> writes(buffers.size());
+        for (uint32_t i = 0; i < buffers.size(); ++i)
+            writes[i]
+                .setDescriptorCount(1)
+                .setDescriptorType(binding_types[i])
+                .setDstArrayElement(0)
+                .setDstBinding(i)
+                .setDstSet(created.set)
+                .setPBufferInfo(&created.buffers[i]);
+        dev.updateDescriptorSets(writes, {});
+        ++update_counter;
+
+        index[key] = entries.size();
+        entries.push_back(std::move(created));
+        return entries.back().set;
+    }
+
+    size_t update_count() const { return update_counter; }
+    size_t reset_count() const { return reset_counter; }
+
+  private:
+    struct entry
+    {
+        vk::DescriptorSet                     set;
+        std::vector<vk::DescriptorBufferInfo> buffers;
+    };
+
+    static size_t
+    hash(vk::ArrayProxy<const vk::DescriptorBufferInfo> buffers)
+    {
+        size_t seed = 0;
+        auto   combine = [&seed](size_t value) {
+            seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        };
+        for (const auto &buffer : buffers)
+        {
+            combine(
+                std::hash<VkBuffer>()(static_cast<VkBuffer>(buffer.buffer)));
+            combine(std::hash<vk::DeviceSize>()(buffer.offset));
+            combine(std::hash<vk::DeviceSize>()(buffer.range));
+        }
+        return seed;
+    }
+
+    static bool matches(const entry &                                  cached,
+                        vk::ArrayProxy<const vk::DescriptorBufferInfo> buffers)
+    {
+        return std::equal(
+            buffers.begin(), buffers.end(), cached.buffers.begin(),
+            [](const vk::DescriptorBufferInfo &a,
+               const vk::DescriptorBufferInfo &b) {
+                return a.buffer == b.buffer && a.offset == b.offset &&
+                       a.range == b.range;
+            });
+    }
+
+    vk::Device                         dev;
+    vk::DescriptorSetLayout            layout;
+    std::vector<vk::DescriptorType>    binding_types;
+    uint32_t                           max_sets = 0;
+    descriptor_pool                    pool;
+    std::vector<entry>                 entries;
+    std::unordered_map<size_t, size_t> index;
+    size_t                             update_counter = 0;
+    size_t                             reset_counter  = 0;
+};
+
+// Writes the descriptors of one set straight into a command buffer from a
+// struct laid out as the entries describe, instead of allocating, updating
+// and binding a set. The set layout must have been created with
+// ePushDescriptorKHR, which rules out dynamic descriptor types: a different
+// buffer range is a different push. Needs the extensions checked by
+// supports_push_descriptors enabled on the device.
+class descriptor_push_template
+{
+  public:
+    descriptor_push_template() = default;
+
+    descriptor_push_template(
+        vk::Device dev, vk::DescriptorSetLayout set_layout,
+        vk::PipelineLayout pipeline_layout, uint32_t set,
+        vk::ArrayProxy<const vk::DescriptorUpdateTemplateEntryKHR> entries)
+        : pipeline_layout(pipeline_layout), set(set)
+    {
+        vk::DescriptorUpdateTemplateCreateInfoKHR create_info;
+        create_info.setDescriptorUpdateEntryCount(entries.size())
+            .setPDescriptorUpdateEntries(entries.data())
+            .setTemplateType(
+                vk::DescriptorUpdateTemplateTypeKHR::ePushDescriptors)
+            .setDescriptorSetLayout(set_layout)
+            .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+            .setPipelineLayout(pipeline_layout)
+            .setSet(set);
+
+        auto vkCreateDescriptorUpdateTemplateKHR =
+            (PFN_vkCreateDescriptorUpdateTemplateKHR)dev.getProcAddr(
+                "vkCreateDescriptorUpdateTemplateKHR");
+        push_descriptor_set =
+            (PFN_vkCmdPushDescriptorSetWithTemplateKHR)dev.getProcAddr(
+                "vkCmdPushDescriptorSetWithTemplateKHR");
+        if (!vkCreateDescriptorUpdateTemplateKHR || !push_descriptor_set)
+            throw std::runtime_error("push descriptors are not enabled");
+
+        vk::DescriptorUpdateTemplateKHR created;
+        vk::Result                      result =
+            static_cast<vk::Result>(vkCreateDescriptorUpdateTemplateKHR(
+                static_cast<VkDevice>(dev),
+                reinterpret_cast<
+                    const VkDescriptorUpdateTemplateCreateInfoKHR *>(
+                    &create_info),
+                nullptr,
+                reinterpret_cast<VkDescriptorUpdateTemplateKHR *>(&created)));
+        update_template = descriptor_update_template(
+            vk::createResultValue(
+                result, created,
+                "vk::Device::createDescriptorUpdateTemplateKHR"),
+            descriptor_update_template_deleter{dev});
+    }
+
+    explicit operator bool() const { return bool(update_template); }
+
+    // data is read while recording, so it may be reused right away
+    void push(vk::CommandBuffer command_buffer, const void *data) const
+    {
+        push_descriptor_set(
+            static_cast<VkCommandBuffer>(command_buffer),
+            static_cast<VkDescriptorUpdateTemplateKHR>(*update_template),
+            static_cast<VkPipelineLayout>(pipeline_layout), set, data);
+    }
+
+  private:
+    descriptor_update_template                update_template;
+    vk::PipelineLayout                        pipeline_layout;
+    uint32_t                                  set                 = 0;
+    PFN_vkCmdPushDescriptorSetWithTemplateKHR push_descriptor_set = nullptr;
+};
+
+// A descriptor set of its own holding an array of up to capacity storage
+// buffers, which shaders index at runtime. It is bound once however many
+// buffers the draws read. Elements are written as buffers are added, also
+// while the set is bound by pending work that does not read them, and the
+// ones never written stay empty. Needs the features checked by
+// supports_descriptor_indexing enabled on the device.
+class storage_buffer_array
+{
+  public:
+    storage_buffer_array() = default;
+
+    storage_buffer_array(vk::Device dev, uint32_t capacity,
+                         vk::ShaderStageFlags stages)
+        : dev(dev), capacity(capacity)
+    {
+        vk::DescriptorSetLayoutBinding binding;
+        binding.setBinding(0)
+            .setDescriptorCount(capacity)
+            .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+            .setStageFlags(stages);
+
+        vk::DescriptorBindingFlagsEXT binding_flags =
+            vk::DescriptorBindingFlagBitsEXT::ePartiallyBound |
+            vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind |
+            vk::DescriptorBindingFlagBitsEXT::eUpdateUnusedWhilePending;
+        vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_info;
+        binding_flags_info.setBindingCount(1).setPBindingFlags(
+            &binding_flags);
+
+        vk::DescriptorSetLayoutCreateInfo layout_create_info;
+        layout_create_info.setPNext(&binding_flags_info)
+            .setFlags(
+                vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT)
+            .setBindingCount(1)
+            .setPBindings(&binding);
+        layout = descriptor_set_layout(
+            dev.createDescriptorSetLayout(layout_create_info),
+            device_child_deleter{dev});
+
+        vk::DescriptorPoolSize pool_size;
+        pool_size.setType(vk::DescriptorType::eStorageBuffer)
+            .setDescriptorCount(capacity);
+        vk::DescriptorPoolCreateInfo pool_create_info;
+        pool_create_info
+            .setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT)
+            .setMaxSets(1)
+            .setPoolSizeCount(1)
+            .setPPoolSizes(&pool_size);
+        pool = descriptor_pool(dev.createDescriptorPool(pool_create_info),
+                               device_child_deleter{dev});
+
+        vk::DescriptorSetAllocateInfo set_allocate_info;
+        set_allocate_info.setDescriptorPool(*pool)
+            .setDescriptorSetCount(1)
+            .setPSetLayouts(&*layout);
+        set = dev.allocateDescriptorSets(set_allocate_info)[0];
+    }
+
+    explicit operator bool() const { return bool(layout); }
+
+    vk::DescriptorSetLayout get_layout() const { return *layout; }
+    vk::DescriptorSet       get_set() const { return set; }
+
+    // Writes buffer to a free element and returns its index.
+    uint32_t add(const vk::DescriptorBufferInfo &buffer)
+    {
+        uint32_t index;
+        if (!free_indices.empty())
+        {
+            index = free_indices.back();
+            free_indices.pop_back();
+        }
+        else if (next_index < capacity)
+            index = next_index++;
+        else
+            throw std::runtime_error("storage buffer array is full");
+
+        vk::WriteDescriptorSet write;
+        write.setDstSet(set)
+            .setDstBinding(0)
+            .setDstArrayElement(index)
+            .setDescriptorCount(1)
+            .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+            .setPBufferInfo(&buffer);
+        dev.updateDescriptorSets({write}, {});
+        return index;
+    }
+
+    // The element keeps its descriptor until it is handed out again, which
+    // must not happen while pending work reads it.
+    void remove(uint32_t index) { free_indices.push_back(index); }
+
+  private:
+    vk::Device            dev;
+    descriptor_set_layout layout;
+    descriptor_pool       pool;
+    vk::DescriptorSet     set;
+    uint32_t              capacity   = 0;
+    uint32_t              next_index = 0;
+    std::vector<uint32_t> free_indices;
+};
+
+// A fixed set of threads that run one task at a time. Thread i always runs
+// index i of a task, so that it can own per-thread resources such as a
+// command pool. The calling thread takes index 0.
+class worker_pool
+{
+  public:
+    explicit worker_pool(size_t thread_count)
+    {
+        if (thread_count == 0)
+            throw std::runtime_error("a worker pool needs at least one thread");
+        for (size_t i = 1; i < thread_count; ++i)
+            threads.emplace_back([this, i]() { work(i); });
+    }
+
+    worker_pool(const worker_pool &) = delete;
+    worker_pool &operator=(const worker_pool &) = delete;
+
+    ~worker_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        started.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    size_t size() const { return threads.size() + 1; }
+
+    // Calls task(i) for every i < size() in parallel and returns once all of
+    // them have. The first exception thrown by any of them is rethrown. The
+    // task is passed by reference, so running it never allocates.
+    template <typename Task>
+    void run(const Task &task)
+    {
+        if (threads.empty())
+        {
+            task(size_t(0));
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &task;
+            invoke  = [](const void *task, size_t index) {
+                (*static_cast<const Task *>(task))(index);
+            };
+            pending = threads.size();
+            ++generation;
+        }
+        started.notify_all();
+
+        std::exception_ptr error;
+        try
+        {
+            task(size_t(0));
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return pending == 0; });
+        if (!error)
+            error = worker_error;
+        worker_error = nullptr;
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+  private:
+    void work(size_t index)
+    {
+        size_t seen = 0;
+        for (;;)
+        {
+            const void *task;
+            void (*call)(const void *, size_t);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                started.wait(lock, [&]() {
+                    return stopping || generation != seen;
+                });
+                if (stopping)
+                    return;
+                seen = generation;
+                task = current;
+                call = invoke;
+            }
+
+            std::exception_ptr error;
+            try
+            {
+                call(task, index);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (error && !worker_error)
+                worker_error = error;
+            if (--pending == 0)
+                finished.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex               mutex;
+    std::condition_variable  started;
+    std::condition_variable  finished;
+    const void *             current = nullptr;
+    void (*invoke)(const void *, size_t) = nullptr;
+    size_t             pending    = 0;
+    size_t             generation = 0;
+    bool               stopping   = false;
+    std::exception_ptr worker_error;
+};
+
+// A bounded queue that any number of threads push to and one thread pops
+// from, without locks. Every cell carries a sequence number that tells
+// producers whether it is free and the consumer whether it is filled, so
+// producers only contend on claiming a position. The capacity is rounded up
+// to a power of two.
+template <typename T>
+class mpsc_queue
+{
+  public:
+    explicit mpsc_queue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        mask = size - 1;
+        cells.reset(new cell[size]);
+        for (size_t i = 0; i < size; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    // Fails without touching value when the queue is full.
+    bool try_push(T &&value)
+    {
+        auto  position = push_position.load(std::memory_order_relaxed);
+        cell *target;
+        for (;;)
+        {
+            target        = &cells[position & mask];
+            auto sequence = target->sequence.load(std::memory_order_acquire);
+            auto lag      = intptr_t(sequence) - intptr_t(position);
+            if (lag == 0)
+            {
+                if (push_position.compare_exchange_weak(
+                        position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (lag < 0)
+                return false;
+            else
+                position = push_position.load(std::memory_order_relaxed);
+        }
+        target->value = std::move(value);
+        target->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only.
+    bool try_pop(T &value)
+    {
+        auto &source = cells[pop_position & mask];
+        if (source.sequence.load(std::memory_order_acquire) !=
+            pop_position + 1)
+            return false;
+        value = std::move(source.value);
+        source.sequence.store(pop_position + mask + 1,
+                              std::memory_order_release);
+        ++pop_position;
+        return true;
+    }
+
+    // Consumer only.
+    bool empty() const
+    {
+        return cells[pop_position & mask].sequence.load(
+                   std::memory_order_acquire) != pop_position + 1;
+    }
+
+    // Positions claimed by producers so far, including pushes that have not
+    // completed yet.
+    size_t push_count() const
+    {
+        return push_position.load(std::memory_order_relaxed);
+    }
+
+    // Consumer only.
+    size_t pop_count() const { return pop_position; }
+
+  private:
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T                   value;
+    };
+
+    std::unique_ptr<cell[]> cells;
+    size_t                  mask;
+    std::atomic<size_t>     push_position{0};
+    // producers write the above and the consumer the below, keep them on
+    // different cache lines without relying on over-aligned allocation
+    char   padding[64];
+    size_t pop_position = 0;
+};
+
+// Whether the cache blob was produced by this exact device and driver,
+// according to the header the driver puts in front of it.
+inline bool
+is_compatible_pipeline_cache(const std::vector<char> &          data,
+                             const vk::PhysicalDeviceProperties &props)
+{
+    const size_t header_size = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+    if (data.size() < header_size)
+        return false;
+
+    uint32_t header[4];
+    std::memcpy(header, data.data(), sizeof(header));
+
+    return header[0] >= header_size &&
+           header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header[2] == props.vendorID && header[3] == props.deviceID &&
+           std::memcmp(data.data() + sizeof(header), props.pipelineCacheUUID,
+                       VK_UUID_SIZE) == 0;
+}
+
+// A name next to filename that no other thread or process picks at the same
+// time, for writing a file that then atomically replaces filename.
+inline std::string temporary_filename(const std::string &filename)
+{
+    static std::atomic<unsigned> counter{0};
+    std::random_device           random;
+
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp",
+                  unsigned(random()), counter++);
+    return filename + suffix;
+}
+
+// Writes the cache back to filename before destroying it. The cache is
+// written to a file of its own and renamed over filename, so concurrent or
+// interrupted runs never observe a partial cache.
+struct pipeline_cache_deleter
+{
+    vk::Device  device;
+    std::string filename;
+
+    void operator()(vk::PipelineCache cache) const
+    {
+        try
+        {
+            auto data      = device.getPipelineCacheData(cache);
+            auto temporary = temporary_filename(filename);
+            {
+                std::ofstream ofs(temporary, std::ios::binary);
+                ofs.write(reinterpret_cast<const char *>(data.data()),
+                          data.size());
+                if (!ofs)
+                    throw std::runtime_error("could not write " + temporary);
+            }
+            if (std::rename(temporary.c_str(), filename.c_str()) != 0)
+                std::remove(temporary.c_str());
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "pipeline cache not saved : " << e.what()
+                      << std::endl;
+        }
+        device.destroyPipelineCache(cache);
+    }
+};
+
+using pipeline_cache = unique_handle<vk::PipelineCache, pipeline_cache_deleter>;
+
+// The file the pipeline cache of a device and driver lives in. Every pair
+// gets a file of its own, so that renderers on different devices never
+// replace each other's cache.
+inline std::string
+pipeline_cache_filename(const vk::PhysicalDeviceProperties &props,
+                        const std::string &                 directory = ".")
+{
+    std::string filename = directory + "/pipeline_cache_";
+
+    char hex[16];
+    std::snprintf(hex, sizeof(hex), "%04x_%04x_", props.vendorID,
+                  props.deviceID);
+    filename += hex;
+    for (size_t i = 0; i < VK_UUID_SIZE; ++i)
+    {
+        std::snprintf(hex, sizeof(hex), "%02x",
+                      unsigned(props.pipelineCacheUUID[i]));
+        filename += hex;
+    }
+    return filename + ".bin";
+}
+
+// Creates a pipeline cache seeded from the device's file in directory, if it
+// holds a compatible cache, that is saved there when it is destroyed.
+inline pipeline_cache create_pipeline_cache(vk::Device          dev,
+                                            vk::PhysicalDevice physical_device,
+                                            const std::string & directory = ".")
+{
+    auto props    = physical_device.getProperties();
+    auto filename = pipeline_cache_filename(props, directory);
+    auto data     = load_binary_file(filename);
+    if (!is_compatible_pipeline_cache(data, props))
+        data.clear();
+
+    vk::PipelineCacheCreateInfo pipeline_cache_create_info;
+    pipeline_cache_create_info.setInitialDataSize(data.size())
+        .setPInitialData(data.data());
+
+    return pipeline_cache(dev.createPipelineCache(pipeline_cache_create_info),
+                          pipeline_cache_deleter{dev, filename});
+}
+
+inline shader_module create_shader(vk::Device device, const uint32_t *code,
+                                   size_t word_count)
+{
+    vk::ShaderModuleCreateInfo shader_module_create_info_vert;
+    shader_module_create_info_vert
+        .setCodeSize(sizeof(uint32_t) * word_count)
+        .setPCode(code);
+
+    return shader_module(
+        device.createShaderModule(shader_module_create_info_vert),
+        device_child_deleter{device});
+}
+
+template <size_t N>
+shader_module create_shader(vk::Device device, const uint32_t (&code)[N])
+{
+    return create_shader(device, code, N);
+}
+
+#ifndef VKX_EMBEDDED_SHADERS
+const shaderc_optimization_level shader_optimization_level =
+    shaderc_optimization_level_size;
+
+inline std::vector<uint32_t> compile_shader(vk::ShaderStageFlagBits stage,
+                                            const std::string &     source)
+{
+    shaderc::CompileOptions compile_options;
+    shaderc::Compiler       compiler;
+
+    shaderc_shader_kind kind;
+
+    switch (stage)
+    {
+    case vk::ShaderStageFlagBits::eVertex:
+        kind = shaderc_shader_kind::shaderc_glsl_vertex_shader;
+        break;
+    case vk::ShaderStageFlagBits::eTessellationControl:
+        kind = shaderc_shader_kind::shaderc_glsl_tess_control_shader;
+        break;
+    case vk::ShaderStageFlagBits::eTessellationEvaluation:
+        kind = shaderc_shader_kind::shaderc_glsl_tess_evaluation_shader;
+        break;
+    case vk::ShaderStageFlagBits::eGeometry:
+        kind = shaderc_shader_kind::shaderc_glsl_geometry_shader;
+        break;
+    case vk::ShaderStageFlagBits::eFragment:
+        kind = shaderc_shader_kind::shaderc_glsl_fragment_shader;
+        break;
+    case vk::ShaderStageFlagBits::eCompute:
+        kind = shaderc_shader_kind::shaderc_glsl_compute_shader;
+        break;
+    default:
+        throw std::runtime_error("unsupported vertex stage");
+    }
+
+    compile_options.SetOptimizationLevel(shader_optimization_level);
+    shaderc::SpvCompilationResult compilation_result =
+        compiler.CompileGlslToSpv(source, kind, "", compile_options);
+
+    if (compilation_result.GetCompilationStatus() !=
+        shaderc_compilation_status::shaderc_compilation_status_success)
+        throw std::runtime_error(compilation_result.GetErrorMessage());
+
+    return std::vector<uint32_t>(compilation_result.begin(),
+                                 compilation_result.end());
+}
+
+inline shader_module create_shader(vk::Device              device,
+                                   vk::ShaderStageFlagBits stage,
+                                   const std::string &     source)
+{
+    auto spirv = compile_shader(stage, source);
+    return create_shader(device, spirv.data(), spirv.size());
+}
+
+// identifies the shaderc build the SPIR-V cache entries come from, the build
+// system passes it in
+#ifndef VKX_SHADERC_VERSION
+#define VKX_SHADERC_VERSION "unknown"
+#endif
+
+// On-disk cache of compiled SPIR-V, keyed by a hash of everything that
+// affects the compiler output. Every entry records how long its compilation
+// took, which is what a hit saves.
+class shader_cache
+{
+  public:
+    shader_cache(std::string directory) : directory(std::move(directory)) {}
+
+    std::vector<uint32_t> compile(vk::ShaderStageFlagBits stage,
+                                  const std::string &     source)
+    {
+        auto filename = directory + "/" + key(stage, source) + ".spv";
+
+        auto start = std::chrono::steady_clock::now();
+        auto data  = load_binary_file(filename);
+        if (data.size() > sizeof(uint64_t) &&
+            (data.size() - sizeof(uint64_t)) % sizeof(uint32_t) == 0)
+        {
+            uint64_t compile_time;
+            std::memcpy(&compile_time, data.data(), sizeof(compile_time));
+
+            std::vector<uint32_t> spirv((data.size() - sizeof(uint64_t)) /
+                                        sizeof(uint32_t));
+            std::memcpy(spirv.data(), data.data() + sizeof(uint64_t),
+                        spirv.size() * sizeof(uint32_t));
+
+            if (spirv.front() == spv_magic)
+            {
+                auto load_time = microseconds_since(start);
+                ++hits;
+                if (compile_time > load_time)
+                    saved += compile_time - load_time;
+                return spirv;
+            }
+        }
+
+        ++misses;
+        auto spirv        = compile_shader(stage, source);
+        auto compile_time = microseconds_since(start);
+
+        auto temporary = temporary_filename(filename);
+        {
+            std::ofstream ofs(temporary, std::ios::binary);
+            ofs.write(reinterpret_cast<const char *>(&compile_time),
+                      sizeof(compile_time));
+            ofs.write(reinterpret_cast<const char *>(spirv.data()),
+                      spirv.size() * sizeof(uint32_t));
+        }
+        if (std::rename(temporary.c_str(), filename.c_str()) != 0)
+            std::remove(temporary.c_str());
+
+        return spirv;
+    }
+
+    size_t hit_count() const { return hits; }
+    size_t miss_count() const { return misses; }
+    double saved_milliseconds() const { return saved / 1000.0; }
+
+  private:
+    static const uint32_t spv_magic = 0x07230203;
+
+    static uint64_t
+    microseconds_since(std::chrono::steady_clock::time_point start)
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count());
+    }
+
+    // FNV-1a over the source, the stage, the compile options, the shaderc
+    // build and the SPIR-V version it targets. The SPIR-V version alone
+    // stays the same across compiler releases that change their output.
+    static std::string key(vk::ShaderStageFlagBits stage,
+                           const std::string &     source)
+    {
+        unsigned int spv_version, spv_revision;
+        shaderc_get_spv_version(&spv_version, &spv_revision);
+
+        std::string input = source + '\0' + vk::to_string(stage) + '\0' +
+                            std::to_string(shader_optimization_level) + '\0' +
+                            VKX_SHADERC_VERSION + '\0' +
+                            std::to_string(spv_version) + '.' +
+                            std::to_string(spv_revision);
+
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : input)
+            hash = (hash ^ c) * 1099511628211ull;
+
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx",
+                      static_cast<unsigned long long>(hash));
+        return hex;
+    }
+
+    std::string directory;
+    size_t      hits   = 0;
+    size_t      misses = 0;
+    uint64_t    saved  = 0;
+};
+
+using spirv_cache = std::unique_ptr<shader_cache>;
+
+inline spirv_cache create_spirv_cache(const std::string &directory = ".")
+{
+    return spirv_cache(new shader_cache(directory));
+}
+
+inline shader_module create_shader(vk::Device              device,
+                                   vk::ShaderStageFlagBits stage,
+                                   const std::string &     source,
+                                   const spirv_cache &     cache)
+{
+    auto spirv = cache->compile(stage, source);
+    return create_shader(device, spirv.data(), spirv.size());
+}
+#endif
+}
+
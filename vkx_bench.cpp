@@ -0,0 +1,765 @@
+#include "render_worker.hpp"
+#include "test_context.hpp"
+#include <new>
+
+// Measures what the renderer's design choices buy, each against a baseline
+// that works the way the renderer used to:
+//
+//     vkx_bench <benchmark> [iterations]
+//
+// Run without arguments to list the benchmarks.
+
+// Every allocating form of operator new is replaced so that heap allocations
+// can be counted, the matching forms of operator delete free what they
+// return.
+static std::atomic<size_t> heap_allocations(0);
+
+static void *counted_new(size_t size)
+{
+    ++heap_allocations;
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new(size_t size)
+{
+    if (void *ptr = counted_new(size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_new(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_new(size);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+
+#ifdef __cpp_aligned_new
+static void *counted_new(size_t size, std::align_val_t alignment)
+{
+    ++heap_allocations;
+    auto align = size_t(alignment);
+    return std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) /
+                                         align * align);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    if (void *ptr = counted_new(size, alignment))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void *operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept
+{
+    return counted_new(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept
+{
+    return counted_new(size, alignment);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+void operator delete(void *ptr, std::align_val_t,
+                     const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+void operator delete[](void *ptr, std::align_val_t,
+                       const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+#endif
+
+namespace
+{
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+// Prints mean, median and worst of latencies, in milliseconds.
+void print_latency(const std::string &what, std::vector<double> latencies)
+{
+    if (latencies.empty())
+        return;
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for (auto latency : latencies)
+        sum += latency;
+    std::cout << what << ": " << sum * 1000 / double(latencies.size())
+              << " ms mean, " << latencies[latencies.size() / 2] * 1000
+              << " ms median, " << latencies.back() * 1000 << " ms max"
+              << std::endl;
+}
+
+// Seconds per job once the renderer is warm, the first job pays for
+// creating its pipeline and slot.
+double seconds_per_job(vkx::renderer &renderer, const vkx::render_job &job,
+                       size_t jobs)
+{
+    auto ignore = [](const void *, size_t) {};
+    renderer.render(job, ignore);
+    renderer.flush();
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < jobs; ++i)
+        renderer.render(job, ignore);
+    renderer.flush();
+    return seconds_since(start) / double(jobs);
+}
+
+// Small meshes, and jobs that draw count of them out of a window that moves
+// every job. A slot never sees the same window twice in a row, so every job
+// is recorded again instead of replayed.
+struct mesh_window
+{
+    std::vector<vkx::mesh> meshes;
+    size_t                 count;
+
+    mesh_window(vkx::renderer &renderer, size_t count,
+                size_t frames_in_flight)
+        : count(count)
+    {
+        for (size_t i = 0; i < count + frames_in_flight; ++i)
+        {
+            auto x = float(i % 16) / 8 - 1;
+            meshes.push_back(renderer.create_mesh(
+                {glm::vec2(x, -0.05f), glm::vec2(x + 0.05f, 0.05f),
+                 glm::vec2(x - 0.05f, 0.05f)}));
+        }
+    }
+
+    vkx::render_job job(size_t index) const
+    {
+        auto            offset = index % (meshes.size() - count + 1);
+        vkx::render_job job;
+        job.meshes.assign(meshes.begin() + ptrdiff_t(offset),
+                          meshes.begin() + ptrdiff_t(offset + count));
+        return job;
+    }
+};
+
+// Seconds spent recording and draws recorded while rendering jobs of window,
+// once the renderer is warm.
+std::pair<double, size_t> recording_of(vkx::renderer &    renderer,
+                                       const mesh_window &window, size_t jobs)
+{
+    auto ignore = [](const void *, size_t) {};
+    renderer.render(window.job(0), ignore);
+    renderer.flush();
+
+    auto seconds = renderer.get_recording_seconds();
+    auto draws   = renderer.get_recorded_draw_count();
+    for (size_t i = 1; i <= jobs; ++i)
+        renderer.render(window.job(i), ignore);
+    renderer.flush();
+    return {renderer.get_recording_seconds() - seconds,
+            renderer.get_recorded_draw_count() - draws};
+}
+
+// The memory a frame slot of a 512x512 RGBA32F job allocates: color and
+// depth attachments and the readback buffer. Buffers of the same sizes stand
+// in for the images, which allocate the same way.
+const std::array<vk::DeviceSize, 3> frame_resource_sizes = {
+    512 * 512 * 16, 512 * 512 * 4, 512 * 512 * 16};
+
+// Before: one vkAllocateMemory per resource, freed with it. After: resources
+// are sub-allocated from the blocks of a memory arena.
+void bench_allocations(size_t iterations)
+{
+    test_context ctx;
+    auto         mem_caps = ctx.physical_device.getMemoryProperties();
+
+    auto   start              = std::chrono::steady_clock::now();
+    size_t device_allocations = 0;
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        for (auto size : frame_resource_sizes)
+        {
+            auto buffer = ctx.create_buffer(size);
+            auto requirements =
+                ctx.device->getBufferMemoryRequirements(*buffer);
+
+            vk::MemoryAllocateInfo memory_allocate_info;
+            memory_allocate_info.setAllocationSize(requirements.size)
+                .setMemoryTypeIndex(uint32_t(vkx::find_memory_index(
+                    mem_caps, requirements.memoryTypeBits,
+                    vkx::memory_usage::device)));
+            auto memory = ctx.device->allocateMemory(memory_allocate_info);
+            ++device_allocations;
+            ctx.device->bindBufferMemory(*buffer, memory, 0);
+            buffer.reset();
+            ctx.device->freeMemory(memory);
+        }
+    }
+    auto before = seconds_since(start);
+
+    // the first frame grows the arena, the following ones reuse its blocks
+    auto arena = vkx::create_memory_arena(*ctx.device, ctx.physical_device);
+    for (auto size : frame_resource_sizes)
+    {
+        auto buffer = ctx.create_buffer(size);
+        vkx::bind(*ctx.device, *buffer, vkx::allocate(arena, *buffer));
+    }
+    auto warm_allocations = arena->device_allocation_count();
+    start                 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        for (auto size : frame_resource_sizes)
+        {
+            auto buffer     = ctx.create_buffer(size);
+            auto allocation = vkx::allocate(arena, *buffer);
+            vkx::bind(*ctx.device, *buffer, allocation);
+        }
+    }
+    auto after = seconds_since(start);
+
+    auto allocations = double(iterations * frame_resource_sizes.size());
+    std::cout << "allocations/s, one vkAllocateMemory per resource: "
+              << allocations / before << " with "
+              << double(device_allocations) / double(iterations)
+              << " device allocations per frame" << std::endl;
+    std::cout << "allocations/s, sub-allocated from an arena: "
+              << allocations / after << " with "
+              << double(arena->device_allocation_count() - warm_allocations) /
+                     double(iterations)
+              << " device allocations per frame" << std::endl;
+
+    // every slot of the renderer allocates once, when it renders its first
+    // job
+    const size_t  frames_in_flight = 3;
+    vkx::renderer renderer(frames_in_flight);
+    auto          ignore = [](const void *, size_t) {};
+    for (size_t i = 0; i < frames_in_flight; ++i)
+        renderer.render(vkx::render_job(), ignore);
+    renderer.flush();
+    warm_allocations = renderer.get_memory_arena()->device_allocation_count();
+    for (size_t i = 0; i < iterations; ++i)
+        renderer.render(vkx::render_job(), ignore);
+    renderer.flush();
+    std::cout << "renderer: "
+              << double(renderer.get_memory_arena()->device_allocation_count() -
+                        warm_allocations) /
+                     double(iterations)
+              << " device allocations per frame after warm-up" << std::endl;
+}
+
+// Before: every job waits for the previous one, as with a single frame in
+// flight. After: recording the next jobs overlaps the GPU work and readback
+// of those in flight.
+void bench_overlap(size_t iterations)
+{
+    for (size_t frames_in_flight : {size_t(1), size_t(3)})
+    {
+        vkx::renderer renderer(frames_in_flight);
+        auto seconds = seconds_per_job(renderer, vkx::render_job(), iterations);
+        std::cout << "jobs/s with " << frames_in_flight
+                  << " frames in flight: " << 1 / seconds << std::endl;
+    }
+}
+
+// Before: a frame was rendered, transitioned and read back by three
+// submissions, each followed by waiting for the queue to idle. After: the
+// same work is recorded into one command buffer with barriers in between
+// and costs one submission and one wait. A fill stands in for rendering, so
+// that both run the exact same commands. The renderer's own end-to-end
+// latency, with one frame in flight so nothing overlaps, is measured too.
+void bench_latency(size_t iterations)
+{
+    {
+        test_context ctx;
+        auto arena = vkx::create_memory_arena(*ctx.device, ctx.physical_device);
+        auto size = frame_resource_sizes[0];
+
+        auto color        = ctx.create_buffer(size);
+        auto color_memory = vkx::allocate(arena, *color);
+        vkx::bind(*ctx.device, *color, color_memory);
+        auto readback        = ctx.create_buffer(size);
+        auto readback_memory = vkx::allocate(arena, *readback,
+                                             vkx::memory_usage::readback);
+        vkx::bind(*ctx.device, *readback, readback_memory);
+
+        vk::BufferMemoryBarrier rendered;
+        rendered.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+            .setDstAccessMask(vk::AccessFlagBits::eTransferRead)
+            .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setBuffer(*color)
+            .setOffset(0)
+            .setSize(VK_WHOLE_SIZE);
+        auto render = [&](vk::CommandBuffer cb) {
+            cb.fillBuffer(*color, 0, VK_WHOLE_SIZE, 0x3f800000);
+        };
+        auto transition = [&](vk::CommandBuffer cb) {
+            cb.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                               vk::PipelineStageFlagBits::eTransfer,
+                               vk::DependencyFlags(), {}, {rendered}, {});
+        };
+        auto read_back = [&](vk::CommandBuffer cb) {
+            vk::BufferCopy buffer_copy;
+            buffer_copy.setSize(size);
+            cb.copyBuffer(*color, *readback, {buffer_copy});
+        };
+
+        using step = std::function<void(vk::CommandBuffer)>;
+        std::vector<vkx::command_buffer> separate;
+        for (const auto &record :
+             {step(render), step(transition), step(read_back)})
+        {
+            separate.push_back(ctx.allocate_command_buffer());
+            vkx::begin(*separate.back());
+            record(*separate.back());
+            vkx::end(*separate.back());
+        }
+        auto combined = ctx.allocate_command_buffer();
+        vkx::begin(*combined);
+        render(*combined);
+        transition(*combined);
+        read_back(*combined);
+        vkx::end(*combined);
+
+        auto submit_and_wait = [&](vk::CommandBuffer cb) {
+            vk::SubmitInfo submit_info;
+            submit_info.setCommandBufferCount(1).setPCommandBuffers(&cb);
+            ctx.queue.submit({submit_info}, vk::Fence());
+            ctx.queue.waitIdle();
+        };
+
+        std::vector<double> before, after;
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (const auto &cb : separate)
+                submit_and_wait(*cb);
+            before.push_back(seconds_since(start));
+
+            start = std::chrono::steady_clock::now();
+            submit_and_wait(*combined);
+            after.push_back(seconds_since(start));
+        }
+        print_latency("three submissions and waits per frame", before);
+        print_latency("one submission and wait per frame", after);
+    }
+
+    vkx::renderer       renderer(1);
+    std::vector<double> latencies;
+    auto                ignore = [](const void *, size_t) {};
+    for (size_t i = 0; i <= iterations; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        renderer.render(vkx::render_job(), ignore);
+        renderer.flush();
+        // the first job creates the renderer's pipeline and slot
+        if (i > 0)
+            latencies.push_back(seconds_since(start));
+    }
+    print_latency("renderer job, render to pixels", latencies);
+}
+
+// Before: every job set up and tore down its own Vulkan context. After: a
+// renderer stays warm across jobs. Cold runs are few, they take long.
+void bench_startup(size_t iterations)
+{
+    auto ignore = [](const void *, size_t) {};
+
+    size_t cold_runs = std::max<size_t>(iterations / 20, 1);
+    auto   start     = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < cold_runs; ++i)
+    {
+        vkx::renderer renderer;
+        renderer.render(vkx::render_job(), ignore);
+        renderer.flush();
+    }
+    auto cold = seconds_since(start) / double(cold_runs);
+
+    vkx::renderer renderer;
+    renderer.render(vkx::render_job(), ignore);
+    renderer.flush();
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        renderer.render(vkx::render_job(), ignore);
+        renderer.flush();
+    }
+    auto warm = seconds_since(start) / double(iterations);
+
+    std::cout << "cold job, context included: " << cold * 1000 << " ms"
+              << std::endl;
+    std::cout << "warm job: " << warm * 1000 << " ms" << std::endl;
+}
+
+// CPU read bandwidth from mapped memory of every host-visible memory type,
+// the way frames are copied out of their readback buffers. Uncached types
+// are what readback used to get by taking the first host-visible one.
+void bench_readback(size_t iterations)
+{
+    test_context ctx;
+    auto         mem_caps = ctx.physical_device.getMemoryProperties();
+    auto         size     = 4 * frame_resource_sizes[0];
+
+    auto buffer = ctx.create_buffer(size);
+    auto allowed =
+        ctx.device->getBufferMemoryRequirements(*buffer).memoryTypeBits;
+    auto picked = vkx::find_memory_index(mem_caps, allowed,
+                                         vkx::memory_usage::readback);
+
+    std::vector<char> frame(size);
+    for (uint32_t i = 0; i < mem_caps.memoryTypeCount; ++i)
+    {
+        auto flags = mem_caps.memoryTypes[i].propertyFlags;
+        if (!(flags & vk::MemoryPropertyFlagBits::eHostVisible) ||
+            !(allowed & (1u << i)))
+            continue;
+
+        vk::MemoryAllocateInfo memory_allocate_info;
+        memory_allocate_info.setAllocationSize(size).setMemoryTypeIndex(i);
+        auto memory = ctx.device->allocateMemory(memory_allocate_info);
+        auto mapped = ctx.device->mapMemory(memory, 0, VK_WHOLE_SIZE);
+        std::memset(mapped, 1, size_t(size));
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t j = 0; j < iterations; ++j)
+        {
+            if (!(flags & vk::MemoryPropertyFlagBits::eHostCoherent))
+                ctx.device->invalidateMappedMemoryRanges(
+                    {vk::MappedMemoryRange(memory, 0, VK_WHOLE_SIZE)});
+            std::memcpy(frame.data(), mapped, frame.size());
+        }
+        auto seconds = seconds_since(start);
+
+        ctx.device->unmapMemory(memory);
+        ctx.device->freeMemory(memory);
+
+        std::cout << "memory type " << i << " (" << vk::to_string(flags)
+                  << "): "
+                  << double(size) * double(iterations) / seconds / (1 << 20)
+                  << " MiB/s" << (i == picked ? ", picked for readback" : "")
+                  << std::endl;
+    }
+}
+
+// Before: handles were shared_ptrs made by copying the Vulkan handle to the
+// heap next to a type-erased deleter, and handles were passed around by
+// copy. After: move-only handles with the deleter in the type. Both own
+// stand-in handle values with a deleter that does nothing, so only what the
+// wrappers themselves cost is measured.
+struct shared_handle_baseline
+{
+    template <typename T>
+    using handle = std::shared_ptr<T>;
+
+    template <typename T, typename Deleter>
+    static handle<T> make_handle(const T &t, Deleter deleter)
+    {
+        return handle<T>(new T(t), [=](const T *ptr) {
+            deleter(*ptr);
+            delete ptr;
+        });
+    }
+};
+
+struct null_deleter
+{
+    void operator()(uint64_t) const {}
+};
+
+// Before: one thread records every job. After: recording threads split the
+// meshes of a job between them, each into its own secondary command buffers
+// from its own pool.
+void bench_recording(size_t iterations)
+{
+    const size_t        frames_in_flight = 3;
+    const size_t        meshes_per_job   = 64;
+    size_t              threads = std::thread::hardware_concurrency();
+    std::vector<size_t> thread_counts;
+    for (size_t count = 1; count < threads; count *= 2)
+        thread_counts.push_back(count);
+    thread_counts.push_back(std::max<size_t>(threads, 1));
+
+    double single_thread = 0;
+    for (auto count : thread_counts)
+    {
+        vkx::renderer renderer(frames_in_flight, count);
+        mesh_window   window(renderer, meshes_per_job, frames_in_flight);
+        auto seconds = recording_of(renderer, window, iterations).first /
+                       double(iterations);
+        if (count == 1)
+            single_thread = seconds;
+        std::cout << "recording with " << count
+                  << " threads: " << seconds * 1000 << " ms per job, "
+                  << single_thread / seconds << "x" << std::endl;
+    }
+}
+
+// Before: producers take turns rendering through a mutex, so each waits for
+// the others' recording and submits. After: they push their jobs into the
+// render worker's queue and the worker renders them. Prints how long handing
+// over a job takes as producers are added.
+void bench_enqueue(size_t iterations)
+{
+    size_t              threads = std::thread::hardware_concurrency();
+    std::vector<size_t> producer_counts;
+    for (size_t count = 1; count < threads; count *= 2)
+        producer_counts.push_back(count);
+    producer_counts.push_back(std::max<size_t>(threads, 1));
+
+    auto ignore = [](const void *, size_t) {};
+    for (auto count : producer_counts)
+    {
+        for (bool worker_thread : {false, true})
+        {
+            vkx::renderer renderer;
+            renderer.render(vkx::render_job(), ignore);
+            renderer.flush();
+
+            std::vector<std::vector<double>> latencies(count);
+            std::vector<std::thread>         producers;
+            {
+                // the worker needs the renderer to itself
+                std::mutex                          render_mutex;
+                std::unique_ptr<vkx::render_worker> worker;
+                if (worker_thread)
+                    worker.reset(new vkx::render_worker(renderer));
+                for (size_t producer = 0; producer < count; ++producer)
+                {
+                    producers.emplace_back([&, producer]() {
+                        vkx::render_job job;
+                        for (size_t i = 0; i < iterations; ++i)
+                        {
+                            auto start = std::chrono::steady_clock::now();
+                            if (worker)
+                                worker->enqueue(job, ignore);
+                            else
+                            {
+                                std::lock_guard<std::mutex> lock(
+                                    render_mutex);
+                                renderer.render(job, ignore);
+                            }
+                            latencies[producer].push_back(
+                                seconds_since(start));
+                        }
+                    });
+                }
+                for (auto &producer : producers)
+                    producer.join();
+            }
+            renderer.flush();
+
+            std::vector<double> all;
+            for (const auto &latency : latencies)
+                all.insert(all.end(), latency.begin(), latency.end());
+            print_latency(std::string(worker_thread ? "render worker"
+                                                    : "shared renderer") +
+                              " with " + std::to_string(count) +
+                              " producers, handing over a job",
+                          all);
+        }
+    }
+}
+
+// Before: every draw binds its mesh through a descriptor set with a dynamic
+// offset. After: the mesh is pushed as a descriptor, or indexed out of a
+// bindless array. Devices that lack a model fall back, which is printed.
+void bench_descriptors(size_t iterations)
+{
+    const size_t frames_in_flight = 3;
+    const size_t meshes_per_job   = 64;
+    for (auto model : {vkx::descriptor_model::bound,
+                       vkx::descriptor_model::pushed,
+                       vkx::descriptor_model::bindless})
+    {
+        vkx::renderer renderer(frames_in_flight, 1, 1,
+                               std::chrono::milliseconds(2), 0, model);
+        mesh_window window(renderer, meshes_per_job, frames_in_flight);
+        auto        recording = recording_of(renderer, window, iterations);
+        std::cout << vkx::to_string(model) << " descriptors, running "
+                  << vkx::to_string(renderer.get_descriptor_model()) << ": "
+                  << recording.first * 1e6 / double(recording.second)
+                  << " us recording per draw" << std::endl;
+    }
+}
+
+// the handles a frame slot owns: attachments, their views and memory, the
+// readback buffer and its memory, a frame buffer, two command buffers and a
+// semaphore
+constexpr size_t handles_per_frame = 12;
+
+// Builds a frame's worth of baseline handles the way the renderer used to,
+// creating each and keeping a copy. Returns the reference count updates
+// that took, read off use_count() around every step.
+size_t baseline_frame()
+{
+    using baseline = shared_handle_baseline;
+
+    long updates = 0;
+    {
+        std::vector<baseline::handle<uint64_t>> frame;
+        frame.reserve(handles_per_frame);
+        for (size_t j = 0; j < handles_per_frame; ++j)
+        {
+            auto created = baseline::make_handle(uint64_t(j + 1),
+                                                 [](uint64_t) {});
+            auto owners  = created.use_count();
+            frame.push_back(created);
+            updates += frame.back().use_count() - owners;
+
+            owners = frame.back().use_count();
+            created.reset();
+            updates += owners - frame.back().use_count();
+        }
+        // every remaining owner lets go when the frame is destroyed
+        for (const auto &handle : frame)
+            updates += handle.use_count();
+    }
+    return size_t(updates);
+}
+
+void bench_handles(size_t iterations)
+{
+    using baseline = shared_handle_baseline;
+
+    {
+        auto allocations = heap_allocations.load();
+        auto start       = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            std::vector<baseline::handle<uint64_t>> frame;
+            frame.reserve(handles_per_frame);
+            for (size_t j = 0; j < handles_per_frame; ++j)
+            {
+                auto created = baseline::make_handle(uint64_t(j + 1),
+                                                     [](uint64_t) {});
+                frame.push_back(created);
+            }
+        }
+        auto seconds = seconds_since(start);
+        allocations  = heap_allocations.load() - allocations;
+
+        // the frame vector's own allocation is not the handles' doing
+        std::cout << "shared_ptr handles: "
+                  << double(allocations - iterations) / double(iterations)
+                  << " heap allocations and " << baseline_frame()
+                  << " atomic reference count updates per frame, "
+                  << seconds * 1e9 / double(iterations * handles_per_frame)
+                  << " ns per handle" << std::endl;
+    }
+
+    {
+        using handle     = vkx::unique_handle<uint64_t, null_deleter>;
+        auto allocations = heap_allocations.load();
+        auto start       = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            std::vector<handle> frame;
+            frame.reserve(handles_per_frame);
+            for (size_t j = 0; j < handles_per_frame; ++j)
+            {
+                handle created(uint64_t(j + 1));
+                frame.push_back(std::move(created));
+            }
+        }
+        auto seconds = seconds_since(start);
+        allocations  = heap_allocations.load() - allocations;
+
+        std::cout << "unique handles: "
+                  << double(allocations - iterations) / double(iterations)
+                  << " heap allocations per frame, "
+                  << seconds * 1e9 / double(iterations * handles_per_frame)
+                  << " ns per handle" << std::endl;
+    }
+
+    // and what a whole warm job allocates in the renderer
+    vkx::renderer renderer;
+    auto          ignore = [](const void *, size_t) {};
+    renderer.render(vkx::render_job(), ignore);
+    renderer.flush();
+    auto allocations = heap_allocations.load();
+    for (size_t i = 0; i < iterations; ++i)
+        renderer.render(vkx::render_job(), ignore);
+    renderer.flush();
+    std::cout << "renderer: "
+              << double(heap_allocations.load() - allocations) /
+                     double(iterations)
+              << " heap allocations per warm job" << std::endl;
+}
+
+const std::map<std::string, void (*)(size_t)> benchmarks = {
+    {"allocations", bench_allocations},
+    {"descriptors", bench_descriptors},
+    {"enqueue", bench_enqueue},
+    {"handles", bench_handles},
+    {"latency", bench_latency},
+    {"overlap", bench_overlap},
+    {"readback", bench_readback},
+    {"recording", bench_recording},
+    {"startup", bench_startup},
+};
+}
+
+int main(int argc, char **argv)
+{
+    auto benchmark = argc > 1 ? benchmarks.find(argv[1]) : benchmarks.end();
+    if (benchmark == benchmarks.end())
+    {
+        std::cout << "usage: vkx_bench <benchmark> [iterations]" << std::endl
+                  << "benchmarks:";
+        for (const auto &known : benchmarks)
+            std::cout << " " << known.first;
+        std::cout << std::endl;
+        return argc > 1 ? -1 : 0;
+    }
+
+    try
+    {
+        benchmark->second(argc > 2 ? std::stoul(argv[2]) : 100);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,286 @@
+#include "renderer_group.hpp"
+#include "test_context.hpp"
+#include <cmath>
+
+// Runs on whatever device the loader finds. Point VK_ICD_FILENAMES at
+// lavapipe, or configure with VKX_TEST_ICD, to run without a GPU.
+
+namespace
+{
+int failures = 0;
+
+void check(bool condition, const std::string &what)
+{
+    if (condition)
+        return;
+    std::cout << "FAILED: " << what << std::endl;
+    ++failures;
+}
+
+// An empty command buffer, ready to be submitted.
+vkx::command_buffer empty_command_buffer(const test_context &ctx)
+{
+    auto cb = ctx.allocate_command_buffer();
+    vkx::begin(*cb);
+    vkx::end(*cb);
+    return cb;
+}
+
+void test_unsubmitted_completion()
+{
+    test_context ctx;
+
+    // neither waits forever for a fence that nobody submitted
+    auto token = std::make_shared<vkx::completion>(*ctx.device);
+    check(!token->ready(), "an unsubmitted token is not ready");
+    bool threw = false;
+    try
+    {
+        token->wait();
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    check(threw, "waiting for an unsubmitted token throws");
+    token.reset();
+}
+
+void test_continuations_run_once()
+{
+    test_context                       ctx;
+    const size_t                       count = 8;
+    std::vector<vkx::command_buffer>   command_buffers;
+    std::vector<vkx::completion_token> tokens;
+    std::vector<size_t>                order;
+    for (size_t i = 0; i < count; ++i)
+    {
+        command_buffers.push_back(empty_command_buffer(ctx));
+        auto token = std::make_shared<vkx::completion>(*ctx.device);
+        token->then([&, i]() { order.push_back(i); });
+
+        vk::CommandBuffer cb = *command_buffers.back();
+        vk::SubmitInfo    submit_info;
+        submit_info.setCommandBufferCount(1).setPCommandBuffers(&cb);
+        token->submit(ctx.queue, submit_info);
+        tokens.push_back(token);
+    }
+
+    // whoever observes completion first runs the continuations, later
+    // observers do not run them again
+    for (const auto &token : tokens)
+        token->wait();
+    for (const auto &token : tokens)
+        check(token->ready(), "a token is ready once waited for");
+    check(order.size() == count, "continuations run exactly once");
+    for (size_t i = 0; i < order.size(); ++i)
+        check(order[i] == i, "continuations run when their token completes");
+
+    bool ran = false;
+    tokens.front()->then([&]() { ran = true; });
+    check(ran, "a continuation added after completion runs right away");
+}
+
+void test_mpsc_queue_delivers_each_value_once()
+{
+    // values are producer * per_producer + i, so that the consumer can tell
+    // who pushed them and in which order
+    const size_t             producer_count = 4;
+    const size_t             per_producer   = 10000;
+    vkx::mpsc_queue<size_t>  queue(64);
+    std::vector<std::thread> producers;
+    for (size_t producer = 0; producer < producer_count; ++producer)
+    {
+        producers.emplace_back([&, producer]() {
+            for (size_t i = 0; i < per_producer; ++i)
+            {
+                auto value = producer * per_producer + i;
+                while (!queue.try_push(std::move(value)))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    std::vector<size_t> next(producer_count, 0);
+    bool                in_order = true;
+    size_t              popped   = 0;
+    while (popped < producer_count * per_producer)
+    {
+        size_t value;
+        if (!queue.try_pop(value))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        ++popped;
+        auto producer = value / per_producer;
+        if (producer >= producer_count ||
+            value % per_producer != next[producer])
+            in_order = false;
+        else
+            ++next[producer];
+    }
+    for (auto &producer : producers)
+        producer.join();
+
+    check(in_order, "every value is popped once, in its producer's order");
+    check(queue.empty(), "nothing is popped twice");
+    check(queue.push_count() == popped && queue.pop_count() == popped,
+          "the queue counts every push and pop");
+}
+
+void test_mpsc_queue_rejects_pushes_when_full()
+{
+    vkx::mpsc_queue<std::unique_ptr<int>> queue(4);
+    for (int i = 0; i < int(queue.capacity()); ++i)
+        check(queue.try_push(std::unique_ptr<int>(new int(i))),
+              "pushes succeed up to the capacity");
+
+    std::unique_ptr<int> value(new int(-1));
+    check(!queue.try_push(std::move(value)), "a full queue rejects a push");
+    check(value && *value == -1, "a rejected value is left alone");
+
+    std::unique_ptr<int> popped;
+    check(queue.try_pop(popped) && popped && *popped == 0,
+          "the oldest value is popped first");
+    check(queue.try_push(std::move(value)), "a pop makes room for a push");
+}
+
+void test_render_worker_flush_waits_for_callbacks()
+{
+    const size_t        count = 16;
+    vkx::renderer       renderer;
+    std::atomic<size_t> called(0);
+    std::atomic<size_t> rejected(0);
+    {
+        vkx::render_worker worker(renderer);
+        for (size_t i = 0; i < count; ++i)
+        {
+            vkx::render_job job;
+            job.width  = 32;
+            job.height = 32;
+            // the renderer refuses empty images
+            if (i == count / 2)
+                job.width = 0;
+            worker.enqueue(job, [&](const void *pixels, size_t) {
+                if (!pixels)
+                    ++rejected;
+                ++called;
+            });
+        }
+        worker.flush();
+
+        check(called.load() == count,
+              "flush returns after every callback ran");
+        check(rejected.load() == 1,
+              "a rejected job is reported with null pixels");
+    }
+    check(called.load() == count, "no callback runs twice");
+}
+
+void test_renderer_group_uses_every_shard()
+{
+    // with a single device both shards share it, like two contexts on one
+    // software ICD
+    const size_t                     count = 64;
+    vkx::renderer_group              group(3, 2);
+    std::vector<std::atomic<size_t>> calls(count);
+    std::atomic<size_t>              wrong_sizes(0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        vkx::render_job job;
+        job.width  = 32;
+        job.height = 32;
+        auto size  = size_t(job.width) * job.height *
+                     vkx::format_size(job.format);
+        group.enqueue(job, [&, i, size](const void *pixels, size_t got) {
+            if (!pixels || got != size)
+                ++wrong_sizes;
+            ++calls[i];
+        });
+    }
+    group.flush();
+
+    bool once = true;
+    for (const auto &called : calls)
+        once = once && called.load() == 1;
+    check(once, "every job of the group calls back once before flush returns");
+    check(wrong_sizes.load() == 0, "every job gets its pixels");
+    check(group.size() == 2, "the group has the shards it was asked for");
+    check(group.get_job_count(0) > 0 && group.get_job_count(1) > 0,
+          "both shards render jobs");
+    check(group.get_job_count(0) + group.get_job_count(1) == count,
+          "the shards render every job between them");
+}
+
+void test_renderer_hands_out_frames_in_order()
+{
+    const size_t  count = 12;
+    vkx::renderer renderer(3, 1, 2);
+
+    std::vector<glm::vec3> colors;
+    std::vector<size_t>    order;
+    for (size_t i = 0; i < count; ++i)
+    {
+        vkx::render_job job;
+        job.width  = 64;
+        job.height = 64;
+        auto color = glm::vec3(float(i + 1) / count, 0.5f, 0.25f);
+        job.constants.fill(color);
+        colors.push_back(color);
+
+        renderer.render(job, [&, i](const void *pixels, size_t size) {
+            order.push_back(i);
+            check(pixels != nullptr, "every job gets its pixels");
+            if (!pixels)
+                return;
+
+            // covered pixels are opaque and carry the color of their job
+            auto   rgba    = static_cast<const float *>(pixels);
+            size_t covered = 0;
+            for (size_t p = 0; p + 4 <= size / sizeof(float); p += 4)
+            {
+                if (rgba[p + 3] != 1.0f)
+                    continue;
+                ++covered;
+                if (std::fabs(rgba[p] - colors[i].x) > 1e-3f ||
+                    std::fabs(rgba[p + 1] - colors[i].y) > 1e-3f ||
+                    std::fabs(rgba[p + 2] - colors[i].z) > 1e-3f)
+                {
+                    check(false, "pixels belong to job " + std::to_string(i));
+                    return;
+                }
+            }
+            check(covered > 0, "jobs cover some pixels");
+        });
+    }
+    renderer.flush();
+
+    check(order.size() == count, "every job calls back once");
+    for (size_t i = 0; i < order.size(); ++i)
+        check(order[i] == i, "jobs call back in submission order");
+}
+}
+
+int main()
+{
+    try
+    {
+        test_unsubmitted_completion();
+        test_continuations_run_once();
+        test_mpsc_queue_delivers_each_value_once();
+        test_mpsc_queue_rejects_pushes_when_full();
+        test_render_worker_flush_waits_for_callbacks();
+        test_renderer_group_uses_every_shard();
+        test_renderer_hands_out_frames_in_order();
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << std::endl;
+        return -1;
+    }
+
+    std::cout << (failures ? "some tests failed" : "all tests passed")
+              << std::endl;
+    return failures ? 1 : 0;
+}